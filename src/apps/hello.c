@@ -0,0 +1,17 @@
+#include "defines.h"
+#include "kozos.h"
+#include "writer.h"
+
+// 動的ロードの例。commandのloadで受信し、スレッドとして起動される
+int main(int argc, char *argv[]) {
+  static kz_writer_t w;
+  int i;
+
+  kz_writer_init(&w, 0);
+  kz_printf("hello from module (id=%lx)\n", (uint32)kz_getid());
+  for (i = 0; i < 3; i++)
+    kz_printf("%d\n", i);
+  kz_flush();
+
+  return 0;
+}
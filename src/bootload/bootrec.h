@@ -0,0 +1,39 @@
+#ifndef _BOOTREC_H_INCLUDED_
+#define _BOOTREC_H_INCLUDED_
+
+// 起動時間の記録。kzloadとOSで共有する(bootload/とos/で同じ内容にしておくこと)。
+// 時刻はkzloadが起動した8ビットタイマ(TMR0/1のカスケード, 409.6us単位)のカウント数。
+// OSはタイマを初期化せずにそのまま読み続ける。
+extern char bootrec; // リンカ・スクリプトで定義される
+#define BOOTREC ((bootrec_t *)&bootrec)
+
+#define BOOTREC_MAGIC 0x6b7a6274 // "kzbt"
+#define BOOTREC_NONE 0xffffffff // 未記録
+
+#define BOOTREC_USEC_PER_COUNT_X10 4096 // 1カウントの時間(0.1us単位)
+
+// 起動の各段階
+#define BOOTREC_RESET      0 // kzloadの起動(タイマの初期化)
+#define BOOTREC_INIT       1 // kzloadの初期化完了
+#define BOOTREC_LOAD_START 2 // loadコマンドの受付
+#define BOOTREC_LOAD_END   3 // XMODEMの受信完了
+#define BOOTREC_ELF_DONE   4 // ELFの配置(BSSの初期化)完了
+#define BOOTREC_RUN        5 // OSへの分岐
+#define BOOTREC_KZ_START   6 // kz_start()の呼び出し
+#define BOOTREC_DISPATCH   7 // 最初のスレッドのディスパッチ
+#define BOOTREC_PROMPT     8 // シェルのプロンプト表示
+#define BOOTREC_NUM        9
+
+typedef struct {
+  uint32 magic;
+  uint32 overflows; // タイマの16ビットのカウンタが一周した回数
+  uint32 stamp[BOOTREC_NUM];
+} bootrec_t;
+
+void bootrec_stamp(int phase); // 現在の時刻を記録する
+#ifdef KOZOS
+int bootrec_valid(void); // kzloadが記録を残しているか
+uint32 bootrec_usec(uint32 count); // カウント数をマイクロ秒に換算する
+#endif
+
+#endif
@@ -38,6 +38,9 @@ struct elf_program_header {
   long align;
 };
 
+// セグメントがLZSSで圧縮されている(tools/kzpack.pyが設定する、OS固有のフラグ)
+#define ELF_PF_KZ_LZSS 0x00100000
+
 // ELFヘッダのバリデーション
 static int elf_check(struct elf_header *header) {
   if (memcmp(header->id.magic, "\x7f" "ELF", 4)) // 0x7f 'E' 'L' 'F'
@@ -66,42 +69,203 @@ static void print_program_header(struct elf_program_header *phdr) {
   putxval(phdr->align, 2); puts("\n");
 }
 
-// セグメント単位でのロード
-static int elf_load_program(struct elf_header *header) {
+// ロード先として書き込んでよい領域(リンカ・スクリプトで定義される)。
+// kzload自身のデータ領域、スタック、受信バッファを壊さないように範囲外は拒否する。
+extern char loadarea_start, loadarea_end;
+
+// 受信しながらロードするための状態
+static struct {
+  char *header; // ELFヘッダとプログラム・ヘッダを溜めておく領域
+  int header_size; // 上記の領域のサイズ
+  long need; // ヘッダとして溜める必要のあるサイズ
+  long offset; // これまでに受け取ったファイル上の位置
+  int ready; // ヘッダを解析済みか
+  int error;
+  int lzss_index; // 展開中の圧縮セグメントの番号(無ければ-1)
+  lzss_decoder lzss;
+} loader;
+
+#define ELF_HEADER ((struct elf_header *)loader.header)
+
+// i番目のプログラム・ヘッダ
+static struct elf_program_header *elf_phdr(int i) {
+  return (struct elf_program_header *)
+    (loader.header + ELF_HEADER->program_header_offset
+     + ELF_HEADER->program_header_size * i);
+}
+
+// 全てのロード可能なセグメントが、ロードしてよい領域に収まるか
+static int elf_check_program(void) {
   int i;
   struct elf_program_header *phdr;
 
-  // セグメント単位でループ
-  for (i = 0; i < header->program_header_num; i++) {
-    // プログラム・ヘッダを取得
-    phdr = (struct elf_program_header *)
-      ((char *)header + header->program_header_offset + header->program_header_size * i);
- 
+  for (i = 0; i < ELF_HEADER->program_header_num; i++) {
+    phdr = elf_phdr(i);
     if (phdr->type != 1) // ロード可能なセグメントか
       continue;
+    // 圧縮セグメントは展開後のサイズを展開時に確認する
+    if ((!(phdr->flags & ELF_PF_KZ_LZSS) && (phdr->file_size > phdr->memory_size)) ||
+        ((char *)phdr->physical_addr < &loadarea_start) ||
+        ((char *)phdr->physical_addr + phdr->memory_size > &loadarea_end)) {
+      puts("segment out of load area: ");
+      print_program_header(phdr);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// 圧縮セグメントの受信した部分を、ロード先に展開する
+static int elf_expand(int i, struct elf_program_header *phdr,
+                      char *buf, long size, long end) {
+  if (loader.lzss_index != i) {
+    loader.lzss_index = i;
+    lzss_decode_init(&loader.lzss, (char *)phdr->physical_addr,
+                     phdr->memory_size);
+  }
+  for (; size > 0; size--) {
+    if (lzss_decode_byte(&loader.lzss, *(buf++)) < 0)
+      return -1;
+  }
+  if (end == phdr->offset + phdr->file_size) {
+    // セグメントの終わりまで受信したので、展開後の残りをBSS領域として初期化
+    if (!lzss_decode_done(&loader.lzss))
+      return -1;
+    memset((char *)phdr->physical_addr + loader.lzss.size, 0,
+           phdr->memory_size - loader.lzss.size);
+    loader.lzss_index = -1;
+  }
+  return 0;
+}
+
+// ファイル上の位置offsetからのsizeバイトを、含まれるセグメントのロード先に書き込む
+static int elf_place(long offset, char *buf, long size) {
+  int i;
+  long start, end;
+  struct elf_program_header *phdr;
+
+  for (i = 0; i < ELF_HEADER->program_header_num; i++) {
+    phdr = elf_phdr(i);
+    if (phdr->type != 1)
+      continue;
+    // セグメントのファイル内の範囲と重なる部分だけを書き込む
+    start = (offset > phdr->offset) ? offset : phdr->offset;
+    end = offset + size;
+    if (end > phdr->offset + phdr->file_size)
+      end = phdr->offset + phdr->file_size;
+    if (start >= end)
+      continue;
+    if (phdr->flags & ELF_PF_KZ_LZSS) {
+      if (elf_expand(i, phdr, buf + (start - offset), end - start, end) < 0) {
+        puts("bad compressed segment: ");
+        print_program_header(phdr);
+        return -1;
+      }
+    } else {
+      memcpy((char *)phdr->physical_addr + (start - phdr->offset),
+             buf + (start - offset), end - start);
+    }
+  }
+  return 0;
+}
+
+int elf_load_init(char *header, int header_size) {
+  loader.header = header;
+  loader.header_size = header_size;
+  loader.need = sizeof(struct elf_header);
+  loader.offset = 0;
+  loader.ready = 0;
+  loader.error = 0;
+  loader.lzss_index = -1;
+  return 0;
+}
 
-    // print_program_header(phdr);
-    memcpy((char *)phdr->physical_addr, // ロード先物理アドレス
-           (char *)header + phdr->offset, // セグメントのファイル内の位置
-           phdr->file_size);
+// 受信したデータを順に渡す。
+// 先頭のヘッダ部分は溜めておいて解析し、以降はセグメントのロード先に直接書き込む。
+int elf_load_write(char *buf, int size) {
+  long n;
+
+  if (loader.error)
+    return -1;
+
+  while (!loader.ready && size > 0) {
+    n = loader.need - loader.offset;
+    if (n > size)
+      n = size;
+    memcpy(loader.header + loader.offset, buf, n);
+    loader.offset += n;
+    buf += n;
+    size -= n;
+    if (loader.offset < loader.need)
+      break;
+
+    if (loader.need == sizeof(struct elf_header)) {
+      // ELFヘッダが揃ったので、プログラム・ヘッダの終わりまでを溜める
+      if (elf_check(ELF_HEADER) < 0)
+        goto error;
+      loader.need = ELF_HEADER->program_header_offset
+        + (long)ELF_HEADER->program_header_size * ELF_HEADER->program_header_num;
+      if (loader.need > loader.header_size) {
+        puts("too many program headers.\n");
+        goto error;
+      }
+    }
+    if (loader.offset >= loader.need) {
+      if (elf_check_program() < 0)
+        goto error;
+      loader.ready = 1;
+      // ヘッダと一緒に溜めた部分にセグメントが含まれていれば、それも書き込む
+      if (elf_place(0, loader.header, loader.offset) < 0)
+        goto error;
+    }
+  }
+
+  if (size > 0) {
+    if (elf_place(loader.offset, buf, size) < 0)
+      goto error;
+    loader.offset += size;
+  }
+  return 0;
+
+error:
+  loader.error = 1;
+  return -1;
+}
+
+// 受信完了後にBSS領域を初期化し、エントリポイントを返す。
+char *elf_load_finish(void) {
+  int i;
+  struct elf_program_header *phdr;
+
+  if (!loader.ready || loader.error)
+    return NULL;
+
+  for (i = 0; i < ELF_HEADER->program_header_num; i++) {
+    phdr = elf_phdr(i);
+    if (phdr->type != 1)
+      continue;
+    if (loader.offset < phdr->offset + phdr->file_size) // 途中までしか受信していない
+      return NULL;
+    if (phdr->flags & ELF_PF_KZ_LZSS) // BSS領域は展開し終えたときに初期化済み
+      continue;
     // .dataセクションと.bssセクションは同じ属性のため、ひとつのセグメントにまとめられている。
     // BSS領域はファイル内では実体を持たないため、メモリ上のサイズに対してファイルサイズが小さくなる。
     memset((char *)phdr->physical_addr + phdr->file_size,
            0, // BSS領域を0で初期化。
            phdr->memory_size - phdr->file_size);
   }
-  
-  return 0;
-}
-
-char *elf_load(char *buf) {
-  struct elf_header *header = (struct elf_header *)buf;
 
-  if (elf_check(header) < 0) // ELFヘッダをチェック。
-    return NULL;
+  return (char *)ELF_HEADER->entry_point; // エントリポイントを返す。
+}
 
-  if (elf_load_program(header) < 0)
-    return NULL;
+// ロードしたプログラムのプログラム・ヘッダ情報を出力。
+int elf_dump(void) {
+  int i;
 
-  return (char *)header->entry_point; // エントリポイントを返す。
+  if (!loader.ready)
+    return -1;
+  puts("offset virtual  physical filesz memsz fl al\n");
+  for (i = 0; i < ELF_HEADER->program_header_num; i++)
+    print_program_header(elf_phdr(i));
+  return 0;
 }
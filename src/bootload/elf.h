@@ -1,6 +1,13 @@
 #ifndef _ELF_H_INCLUDED_
 #define _ELF_H_INCLUDED_
 
-char *elf_load(char *buf);
+#define ELF_HEADER_BUFFER_SIZE 0x100 // ELFヘッダとプログラム・ヘッダを溜める領域のサイズ
+
+// 受信しながらのロード。
+// headerにはELFヘッダとプログラム・ヘッダを溜める領域を渡す。
+int elf_load_init(char *header, int header_size);
+int elf_load_write(char *buf, int size); // 受信したデータを先頭から順に渡す
+char *elf_load_finish(void); // BSSを初期化し、エントリポイントを返す(失敗ならNULL)
+int elf_dump(void); // プログラム・ヘッダの表示
 
 #endif
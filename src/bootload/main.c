@@ -3,12 +3,36 @@
 #include "serial.h"
 #include "xmodem.h"
 #include "elf.h"
+#include "timer.h"
+#include "bootrec.h"
 #include "lib.h"
 
+// XMODEMの受信後、送信側が端末の表示に戻るまで出力を待つ時間
+#define LOAD_SETTLE_MSEC 100
+
+// ROMに書き込まれたOS(os/ld_rom.scr)の先頭のヘッダ
+#define ROMKERNEL_MAGIC 0x6b7a6f73 // "kzos"
+typedef struct {
+  uint32 magic;
+  char *entry_point;
+} romkernel_t;
+
+// ROMにOSが書き込まれていれば、そのエントリ・ポイントを返す
+static char *romkernel_entry(void) {
+  extern char romkernel; // リンカ・スクリプトで定義されている
+  romkernel_t *rk = (romkernel_t *)&romkernel;
+  return (rk->magic == ROMKERNEL_MAGIC) ? rk->entry_point : NULL;
+}
+
 static int init(void) {
   // 以下はリンカ・スクリプトで定義してあるシンボル。
   extern int erodata, data_start, edata, bss_start, ebss;
 
+  // 起動時間を記録できるように、最初にタイマを起動する。
+  // タイマは静的変数を使わないので、データ領域の初期化前でも呼べる。
+  timer_init();
+  bootrec_stamp(BOOTREC_RESET);
+
   // データ領域とBSS領域を初期化する。
   memcpy(&data_start, &erodata, (long)&edata - (long)&data_start);
   memset(&bss_start, 0, (long)&ebss - (long)&bss_start);
@@ -19,37 +43,11 @@ static int init(void) {
   // シリアルの初期化。
   serial_init(SERIAL_DEFAULT_DEVICE);
 
-  return 0;
-}
+  bootrec_stamp(BOOTREC_INIT);
 
-// メモリの16進ダンプ出力
-static int dump(char *buf, long size) {
-  long i;
-
-  if (size < 0) {
-    puts("no data.\n");
-    return -1;
-  }
-  for (i = 0; i < size; i++) {
-    putxval(buf[i], 2);
-    if ((i & 0xf) == 15) {
-      puts("\n");
-    } else {
-      if ((i & 0xf) == 7) puts(" ");
-      puts(" ");
-    }
-  }
-  puts("\n");
-  
   return 0;
 }
 
-static void wait() {
-  volatile long i;
-  for (i = 0; i < 300000; i++)
-    ;
-}
-
 int global_data = 0x10;
 int global_bss;
 static int static_data = 0x20;
@@ -65,10 +63,12 @@ static void printval(void) {
 int main(void) {
   static char buf[16];
   static long size = -1;
-  static unsigned char *loadbuf = NULL;
   static char *entry_point;
   void (*f)(void);
-  extern int buffer_start; // バッファ領域を指すシンボル。リンカスクリプトで定義されている。
+  long baud;
+  uint32 msec;
+  char dec[11];
+  extern char buffer_start; // バッファ領域を指すシンボル。リンカスクリプトで定義されている。
 
   INTR_DISABLE;
   
@@ -80,21 +80,45 @@ int main(void) {
     gets(buf); // シリアルからのコマンド受信。
 
     if (!strcmp(buf, "load")) { // XMODEMでのダウンロード
-      loadbuf = (char *)(&buffer_start);
-      size = xmodem_recv(loadbuf);
-      wait();
+      bootrec_stamp(BOOTREC_LOAD_START);
+      // 受信したブロックは、バッファに溜めずにその場でロード先に書き込む。
+      // バッファ領域はブロックの受信用と、ELFのヘッダを溜める用に分けて使う。
+      elf_load_init(&buffer_start + XMODEM_BUFFER_SIZE, ELF_HEADER_BUFFER_SIZE);
+      size = xmodem_recv(&buffer_start, elf_load_write, &msec);
+      bootrec_stamp(BOOTREC_LOAD_END);
+      entry_point = (size < 0) ? NULL : elf_load_finish();
+      bootrec_stamp(BOOTREC_ELF_DONE);
+      timer_wait_msec(LOAD_SETTLE_MSEC);
       if (size < 0) {
         puts("\nXMODEM receive error!\n");
+      } else if (!entry_point) {
+        puts("\nELF load error!\n");
       } else {
         puts("\nXMODEM receive succeeded.\n");
+        // 転送速度の表示
+        puts(dvaltostr(dec, size, 0));
+        puts(" bytes in ");
+        puts(dvaltostr(dec, msec, 0));
+        puts(" ms (");
+        puts(dvaltostr(dec, msec ? size * 1000 / msec : 0, 0));
+        puts(" bytes/s)\n");
       }
-    } else if (!strcmp(buf, "dump")) { // メモリの16進ダンプ
+    } else if (!strncmp(buf, "baud ", 5)) { // ボーレートの変更
+      baud = atol(buf + 5);
+      puts("switching baud rate to 0x");
+      putxval(baud, 0);
+      puts(".\n");
+      if (serial_config(SERIAL_DEFAULT_DEVICE, baud, SERIAL_FORMAT_8N1) < 0)
+        puts("unsupported baud rate.\n");
+    } else if (!strcmp(buf, "dump")) { // ロードしたプログラムの情報
       puts("size: ");
       putxval(size, 0);
       puts("\n");
-      dump(loadbuf, size);
-    } else if (!strcmp(buf, "run")) { // ELF形式ファイルの実行
-      entry_point = elf_load(loadbuf); // メモリ上に展開
+      if (elf_dump() < 0)
+        puts("no data.\n");
+    } else if (!strcmp(buf, "run")) { // ロードしたプログラムの実行
+      if (!entry_point) // ロードしていなければ、ROM上のOSを起動する
+        entry_point = romkernel_entry();
       if (!entry_point) {
         puts("run error!\n");
       } else {
@@ -102,6 +126,7 @@ int main(void) {
         putxval((unsigned long)entry_point, 0);
         puts("\n");
         f = (void (*)(void))entry_point;
+        bootrec_stamp(BOOTREC_RUN);
         f(); // ロードしたプログラムに処理を渡す
         // ここには基本的に到達しない
       }
@@ -1,8 +1,6 @@
 #include "defines.h"
 #include "serial.h"
 
-#define SERIAL_SCI_NUM 3
-
 #define H8_3069F_SCI0 ((volatile struct h8_3069f_sci *)0xffffb0)
 #define H8_3069F_SCI1 ((volatile struct h8_3069f_sci *)0xffffb8)
 #define H8_3069F_SCI2 ((volatile struct h8_3069f_sci *)0xffffc0)
@@ -49,6 +47,10 @@ struct h8_3069f_sci {
 #define H8_3069F_SCI_SSR_RDRF (1<<6)
 #define H8_3069F_SCI_SSR_TDRE (1<<7)
 
+// 受信エラーのフラグ
+#define H8_3069F_SCI_SSR_ERRORS \
+  (H8_3069F_SCI_SSR_ORER | H8_3069F_SCI_SSR_FERERS | H8_3069F_SCI_SSR_PER)
+
 static struct {
   volatile struct h8_3069f_sci *sci;
 } regs[SERIAL_SCI_NUM] = {
@@ -57,18 +59,79 @@ static struct {
   { H8_3069F_SCI2 },
 };
 
-int serial_init(int index) {
-  volatile struct h8_3069f_sci *sci = regs[index].sci;
+#define SERIAL_CLOCK 20000000L // 周辺クロック(20MHz)
+#define SERIAL_BAUD_ERROR_MAX 3 // ボーレートの許容誤差(%)
+
+// SMRのCKSとBRRを求める。
+// BRR = φ / (64 * 2^(2n-1) * B) - 1 = φ / (32 * 4^n * B) - 1 (nはCKSの値)
+static int serial_calc_brr(long baud, int *cks, int *brr) {
+  int n;
+  long div, actual, err;
+
+  if (baud <= 0)
+    return -1;
+
+  for (n = 0; n < 4; n++) {
+    div = (32L << (2 * n)) * baud;
+    *brr = (SERIAL_CLOCK + div / 2) / div - 1; // 四捨五入
+    if (*brr <= 255)
+      break;
+  }
+  if ((n == 4) || (*brr < 0))
+    return -1;
+  *cks = n;
+
+  // 誤差が大きすぎる設定は受け付けない(20MHzでは115200bpsは約8.5%ずれる)
+  actual = SERIAL_CLOCK / ((32L << (2 * n)) * (*brr + 1));
+  err = (actual > baud) ? (actual - baud) : (baud - actual);
+  if (err * 100 > baud * SERIAL_BAUD_ERROR_MAX)
+    return -1;
 
+  return 0;
+}
+
+// ボーレートと通信フォーマットの設定
+int serial_config(int index, long baud, int format) {
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  volatile long i;
+  int cks, brr;
+  uint8 smr, intr;
+
+  if (serial_calc_brr(baud, &cks, &brr) < 0)
+    return -1;
+
+  smr = cks;
+  if (format & SERIAL_FORMAT_DATA7)
+    smr |= H8_3069F_SCI_SMR_CHR;
+  if (format & (SERIAL_FORMAT_PARITY_EVEN | SERIAL_FORMAT_PARITY_ODD))
+    smr |= H8_3069F_SCI_SMR_PE;
+  if (format & SERIAL_FORMAT_PARITY_ODD)
+    smr |= H8_3069F_SCI_SMR_OE;
+  if (format & SERIAL_FORMAT_STOP2)
+    smr |= H8_3069F_SCI_SMR_STOP;
+
+  // 送信中のデータがあれば、送信完了を待ってから切り替える
+  if (sci->scr & H8_3069F_SCI_SCR_TE) {
+    while (!(sci->ssr & H8_3069F_SCI_SSR_TEND))
+      ;
+  }
+
+  intr = sci->scr & (H8_3069F_SCI_SCR_RIE | H8_3069F_SCI_SCR_TIE);
   sci->scr = 0;
-  sci->smr = 0;
-  sci->brr = 64;
-  sci->scr = H8_3069F_SCI_SCR_RE | H8_3069F_SCI_SCR_TE;
+  sci->smr = smr;
+  sci->brr = brr;
+  for (i = 0; i < SERIAL_CLOCK / baud / 8; i++) // 1ビット期間以上待つ
+    ;
+  sci->scr = H8_3069F_SCI_SCR_RE | H8_3069F_SCI_SCR_TE | intr;
   sci->ssr = 0;
 
   return 0;
 }
 
+int serial_init(int index) {
+  return serial_config(index, SERIAL_DEFAULT_BAUD, SERIAL_FORMAT_8N1);
+}
+
 int serial_is_send_enable(int index) {
   volatile struct h8_3069f_sci *sci = regs[index].sci;
   return (sci->ssr & H8_3069F_SCI_SSR_TDRE);
@@ -85,9 +148,30 @@ int serial_send_byte(int index, unsigned char c) {
   return 0;
 }
 
+// 受信エラーを検出したらフラグを落とす。
+// エラーのフラグが立っている間は受信が止まり、受信エラー割込みも出続けるので、
+// 受信の有無を調べるたびに処理する。
+// フレーミング/パリティ・エラーの文字は壊れているので捨てる。
+// オーバーランでは、受信データ・レジスタに残っている前の文字は有効。
+static void serial_recv_error(int index) {
+  volatile struct h8_3069f_sci *sci = regs[index].sci;
+  uint8 ssr = sci->ssr;
+
+  if (!(ssr & H8_3069F_SCI_SSR_ERRORS))
+    return;
+
+  if (ssr & (H8_3069F_SCI_SSR_FERERS | H8_3069F_SCI_SSR_PER)) {
+    (void)sci->rdr;
+    sci->ssr &= ~(H8_3069F_SCI_SSR_ERRORS | H8_3069F_SCI_SSR_RDRF);
+  } else {
+    sci->ssr &= ~H8_3069F_SCI_SSR_ORER;
+  }
+}
+
 // 受信可能か
 int serial_is_recv_enable(int index) {
   volatile struct h8_3069f_sci *sci = regs[index].sci;
+  serial_recv_error(index);
   return (sci->ssr & H8_3069F_SCI_SSR_RDRF);
 }
 
@@ -1,7 +1,18 @@
 #ifndef _SERIAL_H_INCLUDED_
 #define _SERIAL_H_INCLUDED_
 
+#define SERIAL_SCI_NUM 3 // SCIのチャネル数
+#define SERIAL_DEFAULT_BAUD 9600
+
+// 通信フォーマット(serial_config()のformatに指定する)
+#define SERIAL_FORMAT_8N1 0 // データ8ビット、パリティなし、ストップ1ビット
+#define SERIAL_FORMAT_DATA7 (1<<0) // データ7ビット
+#define SERIAL_FORMAT_PARITY_EVEN (1<<1) // 偶数パリティ
+#define SERIAL_FORMAT_PARITY_ODD (1<<2) // 奇数パリティ
+#define SERIAL_FORMAT_STOP2 (1<<3) // ストップ2ビット
+
 int serial_init(int index); // デバイス初期化
+int serial_config(int index, long baud, int format); // ボーレート等の設定
 int serial_is_send_enable(int index); // 送信可能か
 int serial_send_byte(int index, unsigned char b); // 1文字送信
 int serial_is_recv_enable(int index); // 受信可能か
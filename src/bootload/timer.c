@@ -0,0 +1,82 @@
+#include "defines.h"
+#include "timer.h"
+#include "bootrec.h"
+
+// 8ビットタイマ(チャネル0, 1)
+#define H8_3069F_TMR01 ((volatile struct h8_3069f_tmr01 *)0xffff80)
+
+struct h8_3069f_tmr01 {
+  volatile uint8 tcr0;
+  volatile uint8 tcr1;
+  volatile uint8 tcsr0;
+  volatile uint8 tcsr1;
+  volatile uint8 tcora0;
+  volatile uint8 tcora1;
+  volatile uint8 tcorb0;
+  volatile uint8 tcorb1;
+  volatile uint16 tcnt; // TCNT0(上位)とTCNT1(下位)を16ビットで読む
+};
+
+// TCRの各ビットの定義
+#define H8_3069F_TMR_TCR_CKS_PER8 (1<<0)
+#define H8_3069F_TMR_TCR_CKS_PER64 (2<<0)
+#define H8_3069F_TMR_TCR_CKS_PER8192 (3<<0)
+#define H8_3069F_TMR_TCR_CKS_CASCADE (4<<0) // TCNT1のオーバーフローで数える(TCR0のみ)
+
+// TCSRの各ビットの定義
+#define H8_3069F_TMR_TCSR_OVF (1<<5)
+
+int timer_init(void) {
+  volatile struct h8_3069f_tmr01 *tmr = H8_3069F_TMR01;
+  int i;
+
+  tmr->tcr0 = 0;
+  tmr->tcr1 = 0;
+  tmr->tcnt = 0;
+  tmr->tcsr0 &= ~H8_3069F_TMR_TCSR_OVF;
+  BOOTREC->overflows = 0; // OSが引き継げるように、一周した回数は起動時間の記録に置く
+  BOOTREC->magic = BOOTREC_MAGIC;
+  for (i = 0; i < BOOTREC_NUM; i++)
+    BOOTREC->stamp[i] = BOOTREC_NONE;
+  // 上位(TCNT0)は下位のオーバーフローで数える。カウンタ・クリアはしない。
+  tmr->tcr0 = H8_3069F_TMR_TCR_CKS_CASCADE;
+  tmr->tcr1 = H8_3069F_TMR_TCR_CKS_PER8192;
+
+  return 0;
+}
+
+// 一周(約27秒)するより短い間隔で呼び出すこと
+uint32 timer_get_count(void) {
+  volatile struct h8_3069f_tmr01 *tmr = H8_3069F_TMR01;
+  uint16 count;
+
+  count = tmr->tcnt;
+  if (tmr->tcsr0 & H8_3069F_TMR_TCSR_OVF) {
+    tmr->tcsr0 &= ~H8_3069F_TMR_TCSR_OVF;
+    BOOTREC->overflows++;
+    count = tmr->tcnt; // オーバーフローの前後で読んだ値を使わないように読み直す
+  }
+
+  return (BOOTREC->overflows << 16) | count;
+}
+
+uint32 timer_msec(uint32 count) {
+  // 409.6us単位なので、1000カウントで409.6ms
+  return count * (TIMER_USEC_PER_COUNT_X10 / 8) / (10000 / 8);
+}
+
+uint32 timer_get_msec(void) {
+  return timer_msec(timer_get_count());
+}
+
+// 指定したミリ秒数だけ待つ(1カウント分の誤差がある)
+void timer_wait_msec(uint32 msec) {
+  uint32 start = timer_get_count();
+
+  while (timer_msec(timer_get_count() - start) < msec)
+    ;
+}
+
+void bootrec_stamp(int phase) {
+  BOOTREC->stamp[phase] = timer_get_count();
+}
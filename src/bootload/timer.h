@@ -0,0 +1,14 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+// 経過時間の計測用タイマ(割込みは使わず、ポーリングで読む)。
+// 8ビットタイマ2チャネルをカスケード接続し、φ/8192(409.6us)で数える。
+#define TIMER_USEC_PER_COUNT_X10 4096 // 1カウントの時間(0.1us単位)
+
+int timer_init(void); // タイマの初期化と起動
+uint32 timer_get_count(void); // 起動してからのカウント数
+uint32 timer_get_msec(void); // 起動してからのミリ秒数
+uint32 timer_msec(uint32 count); // カウント数をミリ秒に換算する
+void timer_wait_msec(uint32 msec); // 指定したミリ秒数だけ待つ
+
+#endif
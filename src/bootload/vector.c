@@ -3,17 +3,20 @@
 extern void start(void);
 extern void intr_softerr(void);
 extern void intr_syscall(void);
-extern void intr_serintr(void);
+extern void intr_serintr0(void);
+extern void intr_serintr1(void);
+extern void intr_serintr2(void);
+extern void intr_timintr(void);
 
 void (*vectors[])(void) = {
   start, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   intr_syscall, intr_softerr, intr_softerr, intr_softerr,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, intr_timintr, NULL, NULL, NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-  intr_serintr, intr_serintr, intr_serintr, intr_serintr,
-  intr_serintr, intr_serintr, intr_serintr, intr_serintr,
-  intr_serintr, intr_serintr, intr_serintr, intr_serintr,
+  intr_serintr0, intr_serintr0, intr_serintr0, intr_serintr0,
+  intr_serintr1, intr_serintr1, intr_serintr1, intr_serintr1,
+  intr_serintr2, intr_serintr2, intr_serintr2, intr_serintr2,
 };
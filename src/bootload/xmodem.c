@@ -1,5 +1,6 @@
 #include "defines.h"
 #include "serial.h"
+#include "timer.h"
 #include "lib.h"
 #include "xmodem.h"
 
@@ -11,80 +12,169 @@
 #define XMODEM_NAK 0x15
 #define XMODEM_CAN 0x18
 #define XMODEM_EOF 0x1a /* Ctrl-X */
+#define XMODEM_CRC 'C' // CRCモードでの送信要求
 
 #define XMODEM_BLOCK_SIZE 128
+#define XMODEM_BLOCK_SIZE_1K XMODEM_BUFFER_SIZE
 
-// 受信開始されるまで定期的に送信要求(NAK)を出す。
-static int xmodem_wait(void) {
-  long cnt = 0;
+#define XMODEM_START_MSEC 3000 // 送信要求を出し直す間隔
+#define XMODEM_START_CRC_RETRY 3 // この回数だけCRCモードを要求し、応答が無ければチェックサムに戻す
+#define XMODEM_BYTE_MSEC 1000 // ブロック内の文字間のタイムアウト
+#define XMODEM_RETRY_MAX 10 // 連続して受信エラーになったら中断する
+
+static int use_crc; // 受信モード(CRCモードか)
+static int start_retry; // 送信要求を出した回数
+
+// タイムアウト付きの1文字受信(タイムアウトなら-1)
+static int xmodem_getc(uint32 timeout) {
+  uint32 start = timer_get_msec();
 
   while (!serial_is_recv_enable(SERIAL_DEFAULT_DEVICE)) {
-    if (++cnt >= 2000000) {
-      cnt = 0;
-      serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK);
+    if (timer_get_msec() - start >= timeout)
+      return -1;
+  }
+  return serial_recv_byte(SERIAL_DEFAULT_DEVICE);
+}
+
+// 回線が静かになるまで受信データを読み捨てる(エラー後の再送に備える)
+static void xmodem_purge(void) {
+  while (xmodem_getc(XMODEM_BYTE_MSEC) >= 0)
+    ;
+}
+
+// 受信開始されるまで定期的に送信要求を出す。
+// まずCRCモード('C')を要求し、送信側が応じなければチェックサム(NAK)に切り替える。
+static int xmodem_wait(void) {
+  uint32 start;
+
+  while (1) {
+    serial_send_byte(SERIAL_DEFAULT_DEVICE, use_crc ? XMODEM_CRC : XMODEM_NAK);
+    start = timer_get_msec();
+    while (!serial_is_recv_enable(SERIAL_DEFAULT_DEVICE)) {
+      if (timer_get_msec() - start >= XMODEM_START_MSEC)
+        break;
     }
+    if (serial_is_recv_enable(SERIAL_DEFAULT_DEVICE))
+      return 0;
+    if (++start_retry >= XMODEM_START_CRC_RETRY)
+      use_crc = 0;
   }
-  return 0;
 }
 
 // ブロック単位での受信。
-static int xmodem_read_block(unsigned char block_number, char *buf) {
-  unsigned char c, block_num, check_sum;
-  int i;
+// ブロック番号を返す(番号の確認は呼び出し元で行う)。エラーなら-1
+static int xmodem_read_block(int size, char *buf) {
+  int c, i, block_num;
+  uint16 crc, check;
+  unsigned char check_sum;
 
-  block_num = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (block_num != block_number)
+  if ((block_num = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
     return -1;
-
-  block_num ^= serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (block_num != 0xff)
+  if ((c = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
+    return -1;
+  if ((block_num ^ c) != 0xff)
     return -1;
 
+  crc = 0;
   check_sum = 0;
-  for (i = 0; i < XMODEM_BLOCK_SIZE; i++) {
-    c = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-    *(buf++) = c;
-    check_sum += c;
+  for (i = 0; i < size; i++) {
+    if ((c = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
+      return -1;
+    buf[i] = c;
+    if (use_crc)
+      crc = crc16_byte(crc, c);
+    else
+      check_sum += c;
   }
 
-  check_sum ^= serial_recv_byte(SERIAL_DEFAULT_DEVICE);
-  if (check_sum)
-    return -1;
+  if (use_crc) {
+    // CRCは上位バイトから送られる
+    if ((c = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
+      return -1;
+    check = c << 8;
+    if ((c = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
+      return -1;
+    check |= c;
+    if (check != crc)
+      return -1;
+  } else {
+    if ((c = xmodem_getc(XMODEM_BYTE_MSEC)) < 0)
+      return -1;
+    if ((unsigned char)c != check_sum)
+      return -1;
+  }
+
+  return block_num;
+}
 
-  return i;      
+// 送信側に中断を通知する
+static void xmodem_cancel(void) {
+  serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CAN);
+  serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CAN);
 }
 
-long xmodem_recv(char *buf) {
-  int r, receiving = 0;
-  long size = 0;
-  unsigned char c, block_number = 1;
+long xmodem_recv(char *buf, xmodem_write_t write, uint32 *msec) {
+  int c, r, size, receiving = 0, errors = 0;
+  long total = 0;
+  unsigned char block_number = 1;
+  uint32 start = 0;
+
+  use_crc = 1;
+  start_retry = 0;
 
   while(1) {
     if (!receiving)
       xmodem_wait();
 
-    c = serial_recv_byte(SERIAL_DEFAULT_DEVICE);
+    c = xmodem_getc(receiving ? XMODEM_START_MSEC : XMODEM_BYTE_MSEC);
 
     if (c == XMODEM_EOT) {// 受信完了
       serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
       break;
     } else if (c == XMODEM_CAN) { // 中断
       return -1;
-    } else if (c == XMODEM_SOH) { // 受信開始
+    } else if ((c == XMODEM_SOH) || (c == XMODEM_STX)) { // ブロックの受信
+      if (!receiving)
+        start = timer_get_count();
       receiving++;
-      r = xmodem_read_block(block_number, buf); // ブロック単位での受信
-      if (r < 0) { // 受信エラー
-        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK); // NAKを送信
-      } else { // 正常受信
+      size = (c == XMODEM_STX) ? XMODEM_BLOCK_SIZE_1K : XMODEM_BLOCK_SIZE;
+      r = xmodem_read_block(size, buf); // ブロック単位での受信
+      if (r == block_number) { // 正常受信
+        // 受信したブロックを渡す(書き込み先で受け付けられなければ中断する)
+        if (write(buf, size) < 0) {
+          xmodem_cancel();
+          return -1;
+        }
+        errors = 0;
         block_number++;
-        size += r;
-        buf += r;
+        total += size;
         serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
+      } else if (r == (unsigned char)(block_number - 1)) {
+        // ACKが届かずに再送された前のブロックなので、読み捨ててACKを返す
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_ACK);
+      } else if (r >= 0) { // ブロック番号が飛んだ場合は回復できない
+        xmodem_cancel();
+        return -1;
+      } else { // 受信エラー
+        if (++errors >= XMODEM_RETRY_MAX) {
+          xmodem_cancel();
+          return -1;
+        }
+        xmodem_purge();
+        serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK); // NAKを送信
       }
-    } else {
-      if (receiving)
+    } else if (receiving) {
+      // ブロックの先頭を取りこぼした場合は、NAKで再送を求める
+      if (++errors >= XMODEM_RETRY_MAX) {
+        xmodem_cancel();
         return -1;
+      }
+      xmodem_purge();
+      serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_NAK);
     }
   }
-  return size;
+
+  if (msec)
+    *msec = timer_msec(timer_get_count() - start);
+  return total;
 }
@@ -1,7 +1,14 @@
 #ifndef _XMODEM_H_INCLUDED_
 #define _XMODEM_H_INCLUDED_
 
-// ファイルの受信
-long xmodem_recv(char *buf);
+#define XMODEM_BUFFER_SIZE 1024 // 1ブロックの最大サイズ
+
+// 受信したブロックを受け取る関数(負の値を返すと受信を中断する)
+typedef int (*xmodem_write_t)(char *buf, int size);
+
+// ファイルの受信(XMODEM-CRC/1Kとチェックサム方式に対応)。
+// bufはブロックの受信に使う領域(XMODEM_BUFFER_SIZE以上)で、受信したブロックは
+// 順にwriteに渡す。受信したサイズを返し、msecには最初のブロックから完了までの時間を返す。
+long xmodem_recv(char *buf, xmodem_write_t write, uint32 *msec);
 
 #endif
@@ -0,0 +1,32 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// 10進数の文字列を数値に変換する。
+// "0x"で始まる場合は16進数として扱う。
+long atol(const char *s) {
+  long value = 0;
+  int neg = 0;
+
+  while (*s == ' ')
+    s++;
+  if (*s == '-') {
+    neg = 1;
+    s++;
+  }
+
+  if ((s[0] == '0') && (s[1] == 'x')) {
+    for (s += 2;; s++) {
+      if ((*s >= '0') && (*s <= '9'))
+        value = (value << 4) + (*s - '0');
+      else if ((*s >= 'a') && (*s <= 'f'))
+        value = (value << 4) + (*s - 'a' + 10);
+      else
+        break;
+    }
+  } else {
+    for (; (*s >= '0') && (*s <= '9'); s++)
+      value = value * 10 + (*s - '0');
+  }
+
+  return neg ? -value : value;
+}
@@ -0,0 +1,122 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// COBS(Consistent Overhead Byte Stuffing)による逐次エンコード/デコード。
+// フレームはデータにCRC-16(2バイト)を付加してエンコードし、0x00で区切る。
+// 割込み処理から1バイトずつ呼び出せるように、状態は構造体に保持する。
+
+#define COBS_BLOCK_MAX 254 // 1ブロックに含められる非ゼロのバイト数
+
+#define COBS_ENC_CODE 0 // 次はコード・バイト
+#define COBS_ENC_DATA 1 // ブロック内のデータ
+#define COBS_ENC_END  2 // フレーム区切り(0x00)
+#define COBS_ENC_DONE 3 // 送信完了
+
+void cobs_encode_init(cobs_encoder *enc, const char *buf, int len, uint16 crc) {
+  enc->buf        = buf;
+  enc->len        = len;
+  enc->total      = len + 2;
+  enc->crc        = crc;
+  enc->pos        = 0;
+  enc->block_left = 0;
+  enc->skip_zero  = 0;
+  enc->state      = COBS_ENC_CODE;
+}
+
+// データの後にCRCを上位バイトから続けた、仮想的なバイト列を読む
+static unsigned char cobs_peek(cobs_encoder *enc, int i) {
+  if (i < enc->len)
+    return enc->buf[i];
+  return (i == enc->len) ? (enc->crc >> 8) : (enc->crc & 0xff);
+}
+
+// ブロックの終わりで次の状態を決める
+static int cobs_next_block(cobs_encoder *enc) {
+  if (enc->skip_zero) { // ゼロで区切られたブロックなら、ゼロを読み飛ばして次へ
+    enc->pos++;
+    return COBS_ENC_CODE;
+  }
+  return (enc->pos < enc->total) ? COBS_ENC_CODE : COBS_ENC_END;
+}
+
+// 次に送信するバイトを返す(フレームを送り終えたら-1)
+int cobs_encode_byte(cobs_encoder *enc) {
+  int n;
+  unsigned char c;
+
+  switch (enc->state) {
+  case COBS_ENC_CODE:
+    // 次のゼロ(最大254バイト先)までを1ブロックとする
+    for (n = 0; (n < COBS_BLOCK_MAX) && (enc->pos + n < enc->total); n++) {
+      if (!cobs_peek(enc, enc->pos + n))
+        break;
+    }
+    enc->block_left = n;
+    enc->skip_zero = (enc->pos + n < enc->total) && (n < COBS_BLOCK_MAX);
+    enc->state = n ? COBS_ENC_DATA : cobs_next_block(enc);
+    return n + 1;
+
+  case COBS_ENC_DATA:
+    c = cobs_peek(enc, enc->pos++);
+    if (--enc->block_left == 0)
+      enc->state = cobs_next_block(enc);
+    return c;
+
+  case COBS_ENC_END:
+    enc->state = COBS_ENC_DONE;
+    return 0;
+
+  default:
+    return -1;
+  }
+}
+
+void cobs_decode_init(cobs_decoder *dec, char *buf, int size) {
+  dec->buf          = buf;
+  dec->size         = size;
+  dec->len          = 0;
+  dec->code_left    = 0;
+  dec->zero_pending = 0;
+  dec->overflow     = 0;
+  dec->crc          = 0;
+}
+
+static void cobs_put(cobs_decoder *dec, unsigned char c) {
+  if (dec->len < dec->size) {
+    dec->buf[dec->len++] = c;
+    dec->crc = crc16_byte(dec->crc, c);
+  } else {
+    dec->overflow = 1;
+  }
+}
+
+// 受信したバイトを1つ処理する。
+// フレームの区切りを受信したら、CRCを除いたデータ長を返す。
+// CRC不一致などで壊れたフレームなら-1、フレームの途中や空のフレームなら0を返す。
+int cobs_decode_byte(cobs_decoder *dec, unsigned char c) {
+  int len;
+
+  if (c == 0) { // フレームの区切り
+    if (!dec->len && !dec->code_left) {
+      len = 0; // 区切りの連続は読み捨てる
+    } else if (dec->overflow || dec->code_left || (dec->len < 2) || dec->crc) {
+      len = -1;
+    } else {
+      len = dec->len - 2;
+    }
+    cobs_decode_init(dec, dec->buf, dec->size);
+    return len;
+  }
+
+  if (dec->code_left == 0) { // コード・バイト
+    if (dec->zero_pending) // 前のブロックがゼロで区切られていた
+      cobs_put(dec, 0);
+    dec->zero_pending = (c != 0xff);
+    dec->code_left = c - 1;
+  } else {
+    cobs_put(dec, c);
+    dec->code_left--;
+  }
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// cobs.cとcrc16.cをホストで確かめる(make check)。
+// ボード上のループバック試験(os/test12_1.c)はフレームがDATADRV_FRAME_SIZE以下なので、
+// 254バイトを超える非ゼロの連続やブロックの境界はここで確かめる。
+// kzlib.hと標準ヘッダの宣言が衝突するので、使う関数だけ宣言する。
+
+int printf(const char *format, ...);
+
+#define CHECK_DATA_MAX 1024
+
+static char data[CHECK_DATA_MAX];
+static char frame[CHECK_DATA_MAX * 2];
+static char decoded[CHECK_DATA_MAX + 2];
+static int failed;
+
+static void check(int ok, const char *name, int len, const char *what) {
+  if (!ok) {
+    printf("%s len %d: %s\n", name, len, what);
+    failed++;
+  }
+}
+
+// エンコードしたフレームの長さを返す
+static int encode(int len) {
+  cobs_encoder enc;
+  int c, n = 0;
+
+  cobs_encode_init(&enc, data, len, crc16(0, data, len));
+  while ((c = cobs_encode_byte(&enc)) >= 0)
+    frame[n++] = c;
+  return n;
+}
+
+// フレームを1バイトずつデコードし、最後の区切りでの戻り値を返す
+static int decode(int n, int size) {
+  cobs_decoder dec;
+  int i, r = 0;
+
+  cobs_decode_init(&dec, decoded, size);
+  cobs_decode_byte(&dec, 0); // 前のフレームの区切り
+  for (i = 0; i < n; i++) {
+    r = cobs_decode_byte(&dec, frame[i]);
+    if ((i < n - 1) && r)
+      return -2; // 区切りの前で完了した
+  }
+  return r;
+}
+
+static void check_frame(const char *name, int len) {
+  int i, n, overhead;
+  char c;
+
+  n = encode(len);
+  overhead = (len + 2 + 253) / 254 + 1; // コード・バイトと区切り
+  check(n <= len + 2 + overhead, name, len, "frame too long");
+  check(n > 0 && frame[n - 1] == 0, name, len, "no delimiter");
+  for (i = 0; i < n - 1; i++) {
+    if (!frame[i]) {
+      check(0, name, len, "zero inside frame");
+      break;
+    }
+  }
+
+  check(decode(n, len + 2) == len, name, len, "decode length");
+  for (i = 0; i < len; i++) {
+    if (decoded[i] != data[i]) {
+      check(0, name, len, "data mismatch");
+      break;
+    }
+  }
+
+  // 1バイト化けたら(区切りの値にはしない)CRCで検出される
+  for (i = 0; i < n - 1; i += 97) {
+    c = frame[i];
+    frame[i] = ((c & 0xff) == 0x80) ? 0x40 : c ^ 0x80;
+    check(decode(n, len + 2) < 0, name, len, "corruption not detected");
+    frame[i] = c;
+  }
+
+  // 受信バッファに入りきらなければエラー
+  if (len > 0)
+    check(decode(n, len + 1) == -1, name, len, "overflow not detected");
+}
+
+int main(void) {
+  static const int lens[] = {
+    0, 1, 2, 126, 252, 253, 254, 255, 256, 257, 507, 508, 509, 510, 1000,
+  };
+  int i, j, len;
+
+  check(crc16(0, "123456789", 9) == 0x31c3, "crc16", 9, "check value");
+
+  for (i = 0; i < sizeof(lens) / sizeof(*lens); i++) {
+    len = lens[i];
+
+    for (j = 0; j < len; j++) // 非ゼロの連続(254バイトのブロックをまたぐ)
+      data[j] = (j % 255) + 1;
+    check_frame("nonzero", len);
+
+    for (j = 0; j < len; j++)
+      data[j] = 0xff;
+    check_frame("0xff", len);
+
+    for (j = 0; j < len; j++)
+      data[j] = 0;
+    check_frame("zero", len);
+
+    for (j = 0; j < len; j++) // ちょうど254バイトごとにゼロ
+      data[j] = (j % 255 == 254) ? 0 : 0x55;
+    check_frame("zero at 254", len);
+
+    for (j = 0; j < len; j++)
+      data[j] = (j % 5 == 0) ? 0 : (j % 5 == 1) ? 0xff : ((j * 7) & 0xff) | 1;
+    check_frame("mixed", len);
+  }
+
+  printf("cobs_check %s.\n", failed ? "failed" : "passed");
+  return failed ? 1 : 0;
+}
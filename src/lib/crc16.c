@@ -0,0 +1,24 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// CRC-16/CCITT(多項式0x1021、初期値0。XMODEM-CRCと同じ)
+// RAM上にコードを置くカーネルでも負担にならないよう、4ビット単位の表を使う。
+static const uint16 crc16_table[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+  0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+// 1バイト分のCRC計算
+uint16 crc16_byte(uint16 crc, unsigned char c) {
+  crc = (crc << 4) ^ crc16_table[((crc >> 12) ^ (c >> 4)) & 0xf];
+  crc = (crc << 4) ^ crc16_table[((crc >> 12) ^ c) & 0xf];
+  return crc;
+}
+
+// バッファのCRC計算(データの後にCRCを上位バイトから付加すると、全体のCRCは0になる)
+uint16 crc16(uint16 crc, const void *buf, long len) {
+  const unsigned char *p = buf;
+  for (; len > 0; len--)
+    crc = crc16_byte(crc, *(p++));
+  return crc;
+}
@@ -0,0 +1,72 @@
+#ifndef _KZLIB_H_INCLUDED_
+#define _KZLIB_H_INCLUDED_
+
+// kzload/kozosで共用するライブラリ(libkz.a)
+
+void *memset(void *b, int c, long len);
+void *memcpy(void *dst, const void *src, long len);
+int memcmp(const void *b1, const void *b2, long len);
+
+int strlen(const char *s);
+char *strcpy(char *dst, const char *src);
+int strcmp(const char *s1, const char *s2);
+int strncmp(const char *s1, const char *s2, int len);
+
+// 文字列を数値に変換する("0x"で始まれば16進数)
+long atol(const char *s);
+
+// 数値を16進文字列に変換する(bufは9バイト以上。変換結果の先頭を返す)
+char *xvaltostr(char *buf, unsigned long value, int column);
+// 数値を10進文字列に変換する(bufは11バイト以上。変換結果の先頭を返す)
+char *dvaltostr(char *buf, unsigned long value, int column);
+
+// CRC-16/CCITT(XMODEM-CRCと同じ。多項式0x1021、初期値0)
+uint16 crc16_byte(uint16 crc, unsigned char c);
+uint16 crc16(uint16 crc, const void *buf, long len);
+
+// COBSによるフレームのエンコード(データの後にCRC-16を付加し、0x00で区切る)
+typedef struct {
+  const char *buf;
+  int len;
+  int total; // CRCを含むサイズ
+  uint16 crc;
+  int pos;
+  int block_left;
+  int skip_zero;
+  int state;
+} cobs_encoder;
+
+void cobs_encode_init(cobs_encoder *enc, const char *buf, int len, uint16 crc);
+int cobs_encode_byte(cobs_encoder *enc); // 次に送るバイト(終了なら-1)
+
+// COBSによるフレームのデコード
+typedef struct {
+  char *buf;
+  int size;
+  int len;
+  int code_left;
+  int zero_pending;
+  int overflow;
+  uint16 crc;
+} cobs_decoder;
+
+void cobs_decode_init(cobs_decoder *dec, char *buf, int size);
+int cobs_decode_byte(cobs_decoder *dec, unsigned char c); // フレーム完了でデータ長を返す
+
+// LZSSの逐次展開(データの先頭に展開後のサイズを4バイトで置く)
+typedef struct {
+  char *dst; // 展開先
+  long limit; // 展開先のサイズ
+  long size; // 展開後のサイズ
+  long pos;
+  int count;
+  unsigned int flags;
+  unsigned char match;
+  int state;
+} lzss_decoder;
+
+void lzss_decode_init(lzss_decoder *dec, char *dst, long limit);
+int lzss_decode_byte(lzss_decoder *dec, unsigned char c); // 不正なデータなら-1
+int lzss_decode_done(lzss_decoder *dec); // 全て展開し終えたか
+
+#endif
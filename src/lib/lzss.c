@@ -0,0 +1,79 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// LZSSの逐次展開。
+// データは先頭に展開後のサイズ(4バイト, ビッグエンディアン)を置き、続いて
+// フラグ・バイトと、それに続く8個の要素を繰り返す。フラグの下位ビットから順に、
+// 1ならリテラル(1バイト)、0なら一致(2バイト: 距離-1の下位8ビット,
+// 距離-1の上位4ビット<<4 | 長さ-3)を表す。距離は1〜4096、長さは3〜18。
+// 展開先のメモリそのものを参照窓として使うので、窓のバッファは要らない。
+
+#define LZSS_STATE_SIZE  0 // 展開後のサイズを読む
+#define LZSS_STATE_FLAGS 1 // フラグ・バイトを読む
+#define LZSS_STATE_ITEM  2 // 要素の先頭バイトを読む
+#define LZSS_STATE_MATCH 3 // 一致の2バイト目を読む
+
+#define LZSS_MIN_MATCH 3
+
+void lzss_decode_init(lzss_decoder *dec, char *dst, long limit) {
+  dec->dst   = dst;
+  dec->limit = limit;
+  dec->size  = 0;
+  dec->pos   = 0;
+  dec->count = 0;
+  dec->flags = 0;
+  dec->state = LZSS_STATE_SIZE;
+}
+
+int lzss_decode_byte(lzss_decoder *dec, unsigned char c) {
+  int offset, len;
+
+  switch (dec->state) {
+  case LZSS_STATE_SIZE:
+    dec->size = (dec->size << 8) | c;
+    if (++dec->count == 4) {
+      if (dec->size > dec->limit) // 展開先に収まらない
+        return -1;
+      dec->state = LZSS_STATE_FLAGS;
+    }
+    return 0;
+
+  case LZSS_STATE_FLAGS:
+    dec->flags = c | 0xff00; // 上位の1は、残りの要素数の番兵
+    dec->state = LZSS_STATE_ITEM;
+    return 0;
+
+  case LZSS_STATE_ITEM:
+    if (dec->pos >= dec->size)
+      return -1;
+    if (dec->flags & 1) { // リテラル
+      dec->dst[dec->pos++] = c;
+      break;
+    }
+    dec->match = c;
+    dec->state = LZSS_STATE_MATCH;
+    return 0;
+
+  case LZSS_STATE_MATCH:
+    offset = (dec->match | ((c & 0xf0) << 4)) + 1;
+    len = (c & 0x0f) + LZSS_MIN_MATCH;
+    if ((offset > dec->pos) || (dec->pos + len > dec->size))
+      return -1;
+    // 重なりのある一致もあるので、1バイトずつ前からコピーする
+    for (; len > 0; len--, dec->pos++)
+      dec->dst[dec->pos] = dec->dst[dec->pos - offset];
+    break;
+
+  default:
+    return -1;
+  }
+
+  // 次の要素へ。8個使い切ったら次のフラグ・バイトを読む
+  dec->flags >>= 1;
+  dec->state = (dec->flags & 0x100) ? LZSS_STATE_ITEM : LZSS_STATE_FLAGS;
+  return 0;
+}
+
+int lzss_decode_done(lzss_decoder *dec) {
+  return (dec->state != LZSS_STATE_SIZE) && (dec->pos == dec->size);
+}
@@ -0,0 +1,101 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// メモリを特定パターンで埋める。
+// 偶数アドレスに揃えた後は、4バイト単位(mov.l)で書き込む。
+void *memset(void *b, int c, long len) {
+  char *p = b;
+  uint32 *lp;
+  uint32 v;
+
+  if (len >= 8) {
+    if ((long)p & 1) { // 先頭の奇数アドレス分
+      *(p++) = c;
+      len--;
+    }
+    v = (unsigned char)c;
+    v |= v << 8;
+    v |= v << 16;
+    lp = (uint32 *)p;
+    for (; len >= 16; len -= 16) { // 16バイト単位でループ展開
+      lp[0] = v;
+      lp[1] = v;
+      lp[2] = v;
+      lp[3] = v;
+      lp += 4;
+    }
+    for (; len >= 4; len -= 4)
+      *(lp++) = v;
+    p = (char *)lp;
+  }
+  for (; len > 0; len--) // 末尾の端数
+    *(p++) = c;
+  return b;
+}
+
+// メモリのコピー。
+// コピー元とコピー先の偶奇が一致していれば、4バイト単位でコピーする。
+void *memcpy(void *dst, const void *src, long len) {
+  char *d = dst;
+  const char *s = src;
+  uint32 *ld;
+  const uint32 *ls;
+
+  if ((len >= 8) && !(((long)d ^ (long)s) & 1)) {
+    if ((long)d & 1) { // 先頭の奇数アドレス分
+      *(d++) = *(s++);
+      len--;
+    }
+    ld = (uint32 *)d;
+    ls = (const uint32 *)s;
+    for (; len >= 16; len -= 16) { // 16バイト単位でループ展開
+      ld[0] = ls[0];
+      ld[1] = ls[1];
+      ld[2] = ls[2];
+      ld[3] = ls[3];
+      ld += 4;
+      ls += 4;
+    }
+    for (; len >= 4; len -= 4)
+      *(ld++) = *(ls++);
+    d = (char *)ld;
+    s = (const char *)ls;
+  }
+  for (; len > 0; len--) // 末尾の端数(偶奇が異なる場合は全体)
+    *(d++) = *(s++);
+  return dst;
+}
+
+// メモリの比較。
+// 偶奇が一致していれば4バイト単位で比較し、不一致の位置はバイト単位で調べる。
+int memcmp(const void *b1, const void *b2, long len) {
+  const char *p1 = b1, *p2 = b2;
+  const uint32 *l1, *l2;
+
+  if ((len >= 8) && !(((long)p1 ^ (long)p2) & 1)) {
+    if ((long)p1 & 1) { // 先頭の奇数アドレス分
+      if (*p1 != *p2)
+        return (*p1 > *p2) ? 1 : -1;
+      p1++;
+      p2++;
+      len--;
+    }
+    l1 = (const uint32 *)p1;
+    l2 = (const uint32 *)p2;
+    for (; len >= 4; len -= 4) {
+      if (*l1 != *l2)
+        break;
+      l1++;
+      l2++;
+    }
+    p1 = (const char *)l1;
+    p2 = (const char *)l2;
+  }
+  for (; len > 0; len--) {
+    if (*p1 != *p2)
+      return (*p1 > *p2) ? 1 : -1;
+    p1++;
+    p2++;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// ワード中にゼロのバイトが含まれるかの判定
+#define HASZERO(x) (((x) - 0x01010101UL) & ~(x) & 0x80808080UL)
+
+// ワード単位の読み出しは4バイト境界に揃えて行う。
+// 文字列の終端を越えて読むことがあっても、同じワード内に収まるため
+// RAMの末尾を越えてI/O領域を読むことはない。
+#define ALIGNED(p) (!((long)(p) & 3))
+
+// 文字列の長さを返す。
+int strlen(const char *s) {
+  const char *p = s;
+  const uint32 *lp;
+
+  for (; !ALIGNED(p); p++) { // 4バイト境界までバイト単位
+    if (!*p)
+      return p - s;
+  }
+  for (lp = (const uint32 *)p; !HASZERO(*lp); lp++) // 終端を含むワードまで
+    ;
+  for (p = (const char *)lp; *p; p++)
+    ;
+  return p - s;
+}
+
+// 文字列のコピー。
+char *strcpy(char *dst, const char *src) {
+  char *d = dst;
+  uint32 *ld;
+  const uint32 *ls;
+
+  if (!(((long)dst ^ (long)src) & 1)) { // 偶奇が一致していればワード単位
+    for (; !ALIGNED(src); dst++, src++) {
+      *dst = *src;
+      if (!*src) return d;
+    }
+    ld = (uint32 *)dst;
+    ls = (const uint32 *)src;
+    for (; !HASZERO(*ls); ld++, ls++)
+      *ld = *ls;
+    dst = (char *)ld;
+    src = (const char *)ls;
+  }
+  for (;; dst++, src++) {
+    *dst = *src;
+    if (!*src) break;
+  }
+  return d;
+}
+
+// 文字列の比較。
+int strcmp(const char *s1, const char *s2) {
+  const uint32 *l1, *l2;
+
+  if (!(((long)s1 ^ (long)s2) & 3)) { // 境界が揃っていればワード単位
+    for (; !ALIGNED(s1); s1++, s2++) {
+      if (*s1 != *s2)
+        return (*s1 > *s2) ? 1 : -1;
+      if (!*s1)
+        return 0;
+    }
+    l1 = (const uint32 *)s1;
+    l2 = (const uint32 *)s2;
+    for (; (*l1 == *l2) && !HASZERO(*l1); l1++, l2++)
+      ;
+    s1 = (const char *)l1;
+    s2 = (const char *)l2;
+  }
+  while (*s1 || *s2) {
+    if (*s1 != *s2)
+      return (*s1 > *s2) ? 1 : -1;
+    s1++;
+    s2++;
+  }
+  return 0;
+}
+
+// 長さ制限有りで文字列の比較。
+int strncmp(const char *s1, const char *s2, int len) {
+  const uint32 *l1, *l2;
+
+  if (!(((long)s1 ^ (long)s2) & 3)) { // 境界が揃っていればワード単位
+    for (; !ALIGNED(s1) && len > 0; s1++, s2++, len--) {
+      if (*s1 != *s2)
+        return (*s1 > *s2) ? 1 : -1;
+      if (!*s1)
+        return 0;
+    }
+    l1 = (const uint32 *)s1;
+    l2 = (const uint32 *)s2;
+    for (; (len >= 4) && (*l1 == *l2) && !HASZERO(*l1); l1++, l2++)
+      len -= 4;
+    s1 = (const char *)l1;
+    s2 = (const char *)l2;
+  }
+  while ((*s1 || *s2) && len > 0) {
+    if (*s1 != *s2)
+      return (*s1 > *s2) ? 1 : -1;
+    s1++;
+    s2++;
+    len--;
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include "defines.h"
+#include "kzlib.h"
+
+// 数値を16進文字列に変換する。
+// columnで桁数を指定した場合は、上位をゼロで埋める。
+char *xvaltostr(char *buf, unsigned long value, int column) {
+  char *p;
+
+  p = buf + 8; // 下の桁から処理する。
+  *p = '\0';
+
+  if (column > 8)
+    column = 8;
+
+  do {
+    // 下位4ビット(0-15)を16進数の文字にマッピングする。
+    *(--p) = "0123456789abcdef"[value & 0xf];
+    value >>= 4;
+    column--;
+  } while (value || column > 0);
+
+  return p;
+}
+
+// 数値を10進文字列に変換する。
+// H8/300Hの除算命令(divxu.w)は商が16ビットまでなので、32ビットの除算は
+// libgccの__udivsi3によるビットごとのループになる。1桁あたり最大9回の
+// 10のべき乗の減算で求めたほうが速く、コードも小さい。
+char *dvaltostr(char *buf, unsigned long value, int column) {
+  static const unsigned long dec_unit[] = {
+    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+    10000UL, 1000UL, 100UL, 10UL, 1UL,
+  };
+  char *p, *top;
+  int i;
+
+  if (column > 10)
+    column = 10;
+
+  p = buf;
+  top = NULL;
+  for (i = 0; i < 10; i++) {
+    *p = '0';
+    while (value >= dec_unit[i]) {
+      value -= dec_unit[i];
+      (*p)++;
+    }
+    // 最初の0以外の桁か、桁数指定の範囲から先を返す
+    if (!top && ((*p != '0') || (10 - i <= column) || (i == 9)))
+      top = p;
+    p++;
+  }
+  *p = '\0';
+
+  return top;
+}
@@ -0,0 +1,38 @@
+#include "defines.h"
+#include "bootrec.h"
+
+// kzloadが起動した8ビットタイマ(チャネル0, 1)をそのまま読む
+#define H8_3069F_TMR01_TCSR0 ((volatile uint8 *)0xffff82)
+#define H8_3069F_TMR01_TCNT ((volatile uint16 *)0xffff88)
+
+#define H8_3069F_TMR_TCSR_OVF (1<<5)
+
+int bootrec_valid(void) {
+  return BOOTREC->magic == BOOTREC_MAGIC;
+}
+
+// bootload/timer.cのtimer_get_count()と同じ読み方をする。
+// 一周(約27秒)の間に一度も読まないと、その分は数え損なう。
+static uint32 bootrec_count(void) {
+  uint16 count;
+
+  count = *H8_3069F_TMR01_TCNT;
+  if (*H8_3069F_TMR01_TCSR0 & H8_3069F_TMR_TCSR_OVF) {
+    *H8_3069F_TMR01_TCSR0 &= ~H8_3069F_TMR_TCSR_OVF;
+    BOOTREC->overflows++;
+    count = *H8_3069F_TMR01_TCNT;
+  }
+  return (BOOTREC->overflows << 16) | count;
+}
+
+void bootrec_stamp(int phase) {
+  if (bootrec_valid())
+    BOOTREC->stamp[phase] = bootrec_count();
+}
+
+uint32 bootrec_usec(uint32 count) {
+  // 409.6us単位なので、5カウントで2048us。
+  // 先に掛けると約859秒(2097152カウント)で32ビットを超えるので、5で割ってから掛ける
+  return (count / 5) * (BOOTREC_USEC_PER_COUNT_X10 / 2) +
+         (count % 5) * (BOOTREC_USEC_PER_COUNT_X10 / 2) / 5;
+}
@@ -1,49 +1,146 @@
 #include "defines.h"
 #include "kozos.h"
 #include "consdrv.h"
+#include "interrupt.h"
+#include "serial.h"
 #include "lib.h"
+#include "writer.h"
+#include "bootrec.h"
+#include "module.h"
+#include "klog.h"
+
+#define COMMAND_DEVICE 0 // コマンド処理に使うコンソール・デバイスの番号
 
 // コンソールドライバの使用開始をコンソールドライバに依頼する。
-static void send_use(int index) {
+static void send_use(int index, int bufsize) {
   char *p;
-  p = kz_kmalloc(3);
-  p[0] = '0';
+  p = kz_kmalloc(5);
+  p[0] = '0' + COMMAND_DEVICE;
   p[1] = CONSDRV_CMD_USE; // 初期化コマンド
   p[2] = '0' + index;
-  kz_send(MSGBOX_ID_CONSOUTPUT, 3, p); // コンソールドライバスレッドに送信
+  p[3] = (bufsize >> 8) & 0xff; // 送受信バッファのサイズ
+  p[4] = bufsize & 0xff;
+  kz_send(MSGBOX_ID_CONSOUTPUT, 5, p); // コンソールドライバスレッドに送信
 }
 
-// コンソールへの文字列出力をコンソールドライバに依頼する。
-static void send_write(char *str) {
+// ボーレートの変更をコンソールドライバに依頼する。
+static void send_config(long baud, int format) {
   char *p;
-  int len;
-  len = strlen(str);
-  p = kz_kmalloc(len + 2);
-  p[0] = '0';
-  p[1] = CONSDRV_CMD_WRITE;
-  memcpy(&p[2], str, len);
-  kz_send(MSGBOX_ID_CONSOUTPUT, len + 2, p);
+  p = kz_kmalloc(7);
+  p[0] = '0' + COMMAND_DEVICE;
+  p[1] = CONSDRV_CMD_CONFIG;
+  p[2] = (baud >> 24) & 0xff;
+  p[3] = (baud >> 16) & 0xff;
+  p[4] = (baud >> 8) & 0xff;
+  p[5] = baud & 0xff;
+  p[6] = format;
+  kz_send(MSGBOX_ID_CONSOUTPUT, 7, p);
+}
+
+// 動的メモリの使用状況を表示する。
+static void mem_command(void) {
+  int i;
+  kz_memstat_t mstat;
+  kz_thstat_t tstat;
+
+  kz_printf("size  num  use peak fail spill\n");
+  for (i = 0; kz_memstat(i, &mstat) == 0; i++) {
+    kz_printf("%4d %4d %4d %4d %4d %4d\n", mstat.size, mstat.num,
+              mstat.count, mstat.peak, mstat.fail, mstat.spill);
+  }
+
+  kz_printf("thread   blocks\n");
+  for (i = 0; kz_thstat(i, &tstat) == 0; i++) {
+    if (!tstat.id)
+      continue;
+    kz_printf("%s %d\n", tstat.name, tstat.memblocks);
+  }
+}
+
+// シリアルの統計情報を表示する。
+static void serstat_command(void) {
+  int i;
+  serial_stat_t stat;
+
+  kz_printf("sci       recv       send overrun framing  parity\n");
+  for (i = 0; i < SERIAL_SCI_NUM; i++) {
+    INTR_DISABLE; // 割込み処理で更新されるので、途中で書き換わらないようにする
+    serial_getstat(i, &stat);
+    INTR_ENABLE;
+    kz_printf("%3d %10lu %10lu %7lu %7lu %7lu\n", i, stat.recv, stat.send,
+              stat.overrun, stat.framing, stat.parity);
+  }
+}
+
+// 起動の各段階の時刻(kzloadの起動から)と、前の段階からの経過時間を表示する。
+static void boot_command(void) {
+  static const char *names[BOOTREC_NUM] = { // 表示の幅をそろえてある
+    "reset     ", "init      ", "load start", "load end  ", "elf done  ",
+    "run       ", "kz_start  ", "dispatch  ", "prompt    ",
+  };
+  int i;
+  uint32 usec, prev = 0;
+
+  if (!bootrec_valid()) {
+    kz_printf("no boot record.\n");
+    return;
+  }
+
+  kz_printf("phase          time(ms)    delta(ms)\n");
+  for (i = 0; i < BOOTREC_NUM; i++) {
+    if (BOOTREC->stamp[i] == BOOTREC_NONE) {
+      kz_printf("%s            -\n", names[i]);
+      continue;
+    }
+    usec = bootrec_usec(BOOTREC->stamp[i]);
+    kz_printf("%s %8lu.%03lu %8lu.%03lu\n", names[i],
+              usec / 1000, usec % 1000,
+              (usec - prev) / 1000, (usec - prev) % 1000);
+    prev = usec;
+  }
 }
 
 int command_main(int argc, char *argv[]) {
   char *p;
   int size;
+  kz_writer_t writer;
 
-  send_use(SERIAL_DEFAULT_DEVICE);
+  send_use(SERIAL_DEFAULT_DEVICE, 64);
+  kz_writer_init(&writer, COMMAND_DEVICE);
+  bootrec_stamp(BOOTREC_PROMPT);
 
   while (1) {
-    send_write("command> ");
+    kz_printf("command> ");
+    kz_flush(); // 改行を含まないので、入力を待つ前に送り出す
 
-    kz_recv(MSGBOX_ID_CONSINPUT, &size, &p);
+    kz_recv(MSGBOX_ID_CONSINPUT(COMMAND_DEVICE), &size, &p);
     p[size] = '\0';
 
     if (!strncmp(p, "echo", 4)) {
-      send_write(p + 4);
-      send_write("\n");
+      kz_printf("%s\n", p + 4);
+    } else if (!strncmp(p, "baud ", 5)) {
+      send_config(atol(p + 5), SERIAL_FORMAT_8N1);
+    } else if (!strcmp(p, "mem")) {
+      mem_command();
+    } else if (!strcmp(p, "serstat")) {
+      serstat_command();
+    } else if (!strcmp(p, "klog on")) {
+      // バイナリ形式のログを出力する(tools/kzlog.pyで受信して復元する)
+      klog_record_enable(1);
+    } else if (!strcmp(p, "klog off")) {
+      klog_record_enable(0);
+    } else if (!strcmp(p, "boot")) {
+      boot_command();
+    } else if (!strcmp(p, "load")) {
+      // アプリケーション・モジュールを受信して起動する(tools/kzmod.py sendで送る)
+      module_load(COMMAND_DEVICE);
     } else {
-      send_write("unknown.\n");
+      kz_printf("unknown.\n");
     }
-    kz_kmfree(p); // 送信元で獲得されたメッセージ領域を解放
+    consdrv_release(p); // 受信バッファをコンソールドライバに返却
   }
   return 0;
 }
+
+// コマンドスレッド(起動時にkz_start()が生成する)
+KZ_THREAD_DEFINE(command, command_main, 8, 0x200);
@@ -4,77 +4,235 @@
 #include "interrupt.h"
 #include "serial.h"
 #include "lib.h"
+#include "timer.h"
+#include "klog.h"
 #include "consdrv.h"
 
-#define CONS_BUFFER_SIZE 24
+#define CONS_BUFFER_SIZE 32 // バッファサイズの既定値(2の累乗)
+#define CONS_BUFFER_SIZE_MIN 8
+#define CONS_BUFFER_SIZE_MAX 128
+#define CONS_RECV_BUF_NUM 2 // デバイスごとの受信バッファの面数
+
+// 受信バッファのプール。受信した行はこの領域のバッファのまま読み出し側に渡し、
+// consdrv_release()で返却されるまで読み出し側が所有する。
+static char recv_area[CONSDRV_DEVICE_NUM]
+                     [KZ_POOL_BUFFER_SIZE(CONS_BUFFER_SIZE_MAX, CONS_RECV_BUF_NUM)];
+
+KZ_MSGBOX_DEFINE_ARRAY(consinput, CONSDRV_DEVICE_NUM); // 受信した行(デバイスごと)
+KZ_MSGBOX_DEFINE(consoutput); // ドライバへの要求
 
 static struct consreg {
   kz_thread_id_t id; // コンソールを利用するスレッド
   int index; // 利用するシリアルの番号
   
-  char *send_buf; // 送信バッファ
-  char *recv_buf; // 受信バッファ
-  int send_len; // 送信バッファ中のデータサイズ
-  int recv_len; // 受信バッファ中のデータサイズ
+  char *send_buf; // 送信バッファ(リングバッファ)
+  int buf_mask; // バッファサイズ - 1
+  int send_head; // 送信バッファの読み出し位置
+  int send_tail; // 送信バッファの書き込み位置
+  consdrv_writev_t *wreq_head; // 送信バッファの空き待ちの出力要求のキュー
+  consdrv_writev_t *wreq_tail;
+
+  kz_pool_id_t recv_pool; // 受信バッファのプール
+  char *recv_buf; // 受信中のバッファ(空きがなければNULL)
+  int recv_len; // 受信中のバッファのデータサイズ
+  int recv_drop; // 受信バッファが無いか溢れたために捨てた文字数
 
-  long dummy[3]; // サイズ調整
+  int mode; // CONSDRV_MODE_LINE または CONSDRV_MODE_RAW
+  int chunk; // RAWモードで通知する単位(バイト)
+  int idle; // RAWモードで、受信が途切れてから通知するまでのティック数
+  int idle_count; // 通知までの残りティック数
+  uint16 burst_wait; // RAWモードで、割込み処理内で次の文字を待つ時間(タイマのカウント数。0なら待たない)
 } consreg[CONSDRV_DEVICE_NUM];
 
+// SCIのチャネル番号から、それを使用しているデバイスを引くための表
+static struct consreg *sci_cons[SERIAL_SCI_NUM];
+
+// リングバッファ中のデータサイズ
+#define RING_LEN(cons, head, tail) (((tail) - (head)) & (cons)->buf_mask)
+// リングバッファの空きサイズ(head == tailを空とするため、1バイトは使わない)
+#define RING_SPACE(cons, head, tail) ((cons)->buf_mask - RING_LEN(cons, head, tail))
+
 // 以下二つの関数は割込み処理とスレッドから呼ばれるが
 // 送信バッファを使用しており再入不可のため、スレッドから呼び出す場合は
 // 排他のため割り込み禁止状態で呼ぶこと
 
 static void send_char(struct consreg *cons) {
-  int i;
-  serial_send_byte(cons->index, cons->send_buf[0]);
-  cons->send_len--;
+  serial_send_byte(cons->index, cons->send_buf[cons->send_head]);
+  cons->send_head = (cons->send_head + 1) & cons->buf_mask;
+}
 
-  // 先頭文字を送信したので、1文字分ずらす
-  for (i = 0; i < cons->send_len; i++) {
-    cons->send_buf[i] = cons->send_buf[i + 1];
+// 送信が止まっていれば、送信割込みを有効にして送信を始める
+static void send_start(struct consreg *cons) {
+  if ((cons->send_head != cons->send_tail) &&
+      !serial_intr_is_send_enable(cons->index)) {
+    serial_intr_send_enable(cons->index); // 送信割込み有効化
+    send_char(cons);
   }
 }
 
-static void send_string(struct consreg *cons, char *str, int len) {
+// 送信バッファに格納できた文字数を返す(溢れた分は捨てる)
+static int send_string(struct consreg *cons, char *str, int len) {
   int i;
   for (i = 0; i < len; i++) { // 文字列を送信バッファにコピー
-    if (str[i] == '\n')
-      cons->send_buf[cons->send_len++] = '\r';
-    cons->send_buf[cons->send_len++] = str[i];
+    if ((str[i] == '\n') && (cons->mode == CONSDRV_MODE_LINE)) {
+      if (RING_SPACE(cons, cons->send_head, cons->send_tail) < 2)
+        break;
+      cons->send_buf[cons->send_tail] = '\r';
+      cons->send_tail = (cons->send_tail + 1) & cons->buf_mask;
+    } else {
+      if (RING_SPACE(cons, cons->send_head, cons->send_tail) < 1)
+        break;
+    }
+    cons->send_buf[cons->send_tail] = str[i];
+    cons->send_tail = (cons->send_tail + 1) & cons->buf_mask;
   }
-  if (cons->send_len && !serial_intr_is_send_enable(cons->index)) {
-    serial_intr_send_enable(cons->index); // 送信割込み有効化
-    send_char(cons);
+  send_start(cons);
+  return i;
+}
+
+// 受信バッファを、そのままデバイスを使用するスレッドに渡す(割込み処理から呼ぶ)
+static void recv_deliver(struct consreg *cons) {
+  kx_send(MSGBOX_ID_CONSINPUT(cons - consreg), cons->recv_len, cons->recv_buf);
+  cons->recv_buf = kx_pool_get(cons->recv_pool);
+  cons->recv_len = 0;
+}
+
+// 受信バッファに1文字格納する。
+// 受信側で終端文字を付加できるように、最後の1バイトは空けておく。
+// 格納できない文字は捨てる(行が長すぎる場合は切り詰められる)。
+static void recv_char(struct consreg *cons, unsigned char c) {
+  if (!cons->recv_buf) // 読み出し側が返却していれば再取得する
+    cons->recv_buf = kx_pool_get(cons->recv_pool);
+  if (cons->recv_buf && (cons->recv_len < cons->buf_mask)) {
+    cons->recv_buf[cons->recv_len++] = c;
+  } else {
+    cons->recv_drop++;
   }
 }
 
+// 出力要求の続きを送信バッファにコピーし、完了した要求のリストを返す。
+// 送信バッファが一杯になった要求は、非ブロッキングでなければキューの先頭に残す。
+static consdrv_writev_t *writev_proceed(struct consreg *cons) {
+  consdrv_writev_t *req, *done = NULL, **donep = &done;
+  int n;
+
+  while ((req = cons->wreq_head) != NULL) {
+    while (req->cur < req->num) {
+      n = send_string(cons, req->seg[req->cur].p + req->offset,
+                      req->seg[req->cur].size - req->offset);
+      req->offset += n;
+      req->done += n;
+      if (req->offset < req->seg[req->cur].size)
+        break; // 送信バッファが一杯
+      req->cur++;
+      req->offset = 0;
+    }
+    if ((req->cur < req->num) && !(req->flags & CONSDRV_WRITEV_FLAG_NONBLOCK))
+      break; // 空きができるまで待つ
+
+    cons->wreq_head = req->next;
+    if (!cons->wreq_head)
+      cons->wreq_tail = NULL;
+    req->next = NULL;
+    *donep = req;
+    donep = &req->next;
+  }
+
+  return done;
+}
+
+// カーネルのログを送信バッファに移す(割込み処理から呼ぶ)。
+// ログは標準のシリアルを使う行モードのデバイスにのみ出力する。
+static void klog_drain(struct consreg *cons) {
+  if ((cons->index != SERIAL_DEFAULT_DEVICE) || (cons->mode != CONSDRV_MODE_LINE))
+    return;
+  // ログは改行の変換やバイナリの記録も済んだ形で格納されているので、そのままコピーする
+  while (klog_pending() &&
+         (RING_SPACE(cons, cons->send_head, cons->send_tail) > 0)) {
+    cons->send_buf[cons->send_tail] = klog_getc();
+    cons->send_tail = (cons->send_tail + 1) & cons->buf_mask;
+  }
+  send_start(cons);
+}
+
+// 割込み処理の中で、次の文字が届くまでポーリングで待つ。
+// *elapsedに待った時間を加算し、待ち時間か1回の割込み処理で使える時間を
+// 超えたら0を返す(受信が途切れたので割込み待ちに戻る)。
+static int recv_wait(struct consreg *cons, long *elapsed) {
+  uint16 last, now;
+  long start = *elapsed;
+
+  last = timer_get_count();
+  while (!serial_is_recv_enable(cons->index)) {
+    now = timer_get_count();
+    *elapsed += (now >= last) ? (now - last) : (now + TIMER_COUNT_PER_TICK - last);
+    last = now;
+    if ((*elapsed - start > cons->burst_wait) || (*elapsed > TIMER_COUNT_PER_TICK))
+      return 0;
+  }
+  return 1;
+}
+
+// RAWモードの待ち時間を、現在の通信速度の1.5文字分にする。
+// SCIにはFIFOが無く、ティックごとのポーリングでは取りこぼすので、受信割込みは
+// 止めずに、連続して届く文字を1回の割込み処理の中でまとめて受信する。
+// 1文字の時間がティックの半分を超える低速な設定では、待つだけ無駄なので使わない。
+static void burst_setup(struct consreg *cons) {
+  long wait;
+
+  wait = serial_char_clocks(cons->index) / TIMER_CLOCK_DIV;
+  wait += wait / 2;
+  cons->burst_wait = (wait <= TIMER_COUNT_PER_TICK / 2) ? wait : 0;
+}
+
 static int consdrv_intrporc(struct consreg *cons) {
   unsigned char c;
-  char *p;
+  consdrv_writev_t *req;
+  long elapsed = 0;
 
   if (serial_is_recv_enable(cons->index)) {
     c = serial_recv_byte(cons->index);
-    if (c == '\r') // 改行コード変換
-      c = '\n';
-
-    send_string(cons, &c, 1); // エコーバック処理
-
-    if (cons->id) {
-      if (c != '\n') {
-        // 改行でないなら、受信バッファにバッファリングする
-        cons->recv_buf[cons->recv_len++] = c;
-      } else {
-        // Enterが押されたら、バッファの内容をコマンド処理スレッドに通知する。
-        p = kx_kmalloc(CONS_BUFFER_SIZE);
-        memcpy(p, cons->recv_buf, cons->recv_len);
-        kx_send(MSGBOX_ID_CONSINPUT, cons->recv_len, p);
-        cons->recv_len = 0;
+
+    if (cons->mode == CONSDRV_MODE_RAW) {
+      // RAWモードでは変換もエコーバックもせず、一定量溜まるか
+      // 受信が途切れたところでまとめて通知する
+      while (1) {
+        recv_char(cons, c);
+        if (cons->recv_len >= cons->chunk)
+          recv_deliver(cons);
+        // 続けて届く文字は、割込みの出入りを省いてここで受信する
+        if (!cons->burst_wait || !recv_wait(cons, &elapsed))
+          break;
+        c = serial_recv_byte(cons->index);
+      }
+      cons->idle_count = cons->idle;
+    } else {
+      if (c == '\r') // 改行コード変換
+        c = '\n';
+
+      send_string(cons, &c, 1); // エコーバック処理
+
+      if (cons->id) {
+        if (c != '\n') {
+          // 改行でないなら、受信バッファにバッファリングする
+          recv_char(cons, c);
+        } else {
+          // Enterが押されたら、バッファをコマンド処理スレッドに渡す。
+          if (!cons->recv_buf)
+            cons->recv_buf = kx_pool_get(cons->recv_pool);
+          if (cons->recv_buf)
+            recv_deliver(cons);
+        }
       }
     }
   }
 
   if (serial_is_send_enable(cons->index)) {
-    if (!cons->id || !cons->send_len) {
+    // 空き待ちの出力要求があれば続きをコピーし、完了したスレッドを起こす
+    for (req = writev_proceed(cons); req; req = req->next)
+      kx_wakeup(req->id);
+    klog_drain(cons);
+    if (!cons->id || (cons->send_head == cons->send_tail)) {
       serial_intr_send_disable(cons->index);
     } else {
       send_char(cons);
@@ -84,17 +242,41 @@ static int consdrv_intrporc(struct consreg *cons) {
   return 0;
 }
 
-static void consdrv_intr(void) {
+// 割込みはSCIのチャネルごとに別のベクタで通知されるので、
+// 全デバイスを走査せずに該当するデバイスだけを処理する
+static void consdrv_intr_sci(int index) {
+  struct consreg *cons = sci_cons[index];
+
+  if (cons && cons->id) {
+    if (serial_is_send_enable(cons->index) ||
+        serial_is_recv_enable(cons->index))
+      // 割込み処理があるならば、割込み処理を呼び出す
+      consdrv_intrporc(cons);
+  }
+}
+
+static void consdrv_intr0(void) { consdrv_intr_sci(0); }
+static void consdrv_intr1(void) { consdrv_intr_sci(1); }
+static void consdrv_intr2(void) { consdrv_intr_sci(2); }
+
+static kz_handler_t consdrv_intr[SERIAL_SCI_NUM] = {
+  consdrv_intr0, consdrv_intr1, consdrv_intr2,
+};
+
+// RAWモードの受信途切れの検出とカーネルのログの送信開始(タイマ割込みから呼ばれる)
+static void consdrv_tick(void) {
   int i;
   struct consreg *cons;
 
   for (i = 0; i < CONSDRV_DEVICE_NUM; i++) {
     cons = &consreg[i];
-    if (cons->id) {
-      if (serial_is_send_enable(cons->index) ||
-          serial_is_recv_enable(cons->index))
-        // 割込み処理があるならば、割込み処理を呼び出す
-        consdrv_intrporc(cons);
+    if (cons->id)
+      klog_drain(cons); // 送信が止まっていれば、ここでログの送信を始める
+    if (cons->id && (cons->mode == CONSDRV_MODE_RAW) && cons->idle_count) {
+      if (--cons->idle_count == 0) {
+        if (cons->recv_len)
+          recv_deliver(cons);
+      }
     }
   }
 }
@@ -102,23 +284,40 @@ static void consdrv_intr(void) {
 // 初期化処理
 static int consdrv_init(void) {
   memset(consreg, 0, sizeof(consreg));
+  memset(sci_cons, 0, sizeof(sci_cons));
   return 0;
 }
 
 // スレッドからの要求を処理する
 static int consdrv_command(struct consreg *cons, kz_thread_id_t id,
                            int index, int size, char *command) {
+  int bufsize, n;
+  long baud;
+  consdrv_writev_t *wv, *req;
 
   switch (command[0]) {
   case CONSDRV_CMD_USE:
+    // バッファサイズの指定があれば、2の累乗に切り上げて使う
+    bufsize = CONS_BUFFER_SIZE;
+    if (size >= 4)
+      bufsize = ((unsigned char)command[2] << 8) | (unsigned char)command[3];
+    for (n = CONS_BUFFER_SIZE_MIN; n < bufsize && n < CONS_BUFFER_SIZE_MAX; n <<= 1)
+      ;
     cons->id = id;
     cons->index = command[1] - '0';
-    cons->send_buf = kz_kmalloc(CONS_BUFFER_SIZE);
-    cons->recv_buf = kz_kmalloc(CONS_BUFFER_SIZE);
-    cons->send_len = 0;
+    sci_cons[cons->index] = cons;
+    cons->send_buf = kz_kmalloc(n);
+    cons->buf_mask = n - 1;
+    cons->send_head = cons->send_tail = 0;
+    cons->recv_pool = kz_pool_create(recv_area[index], sizeof(recv_area[index]), n);
+    cons->recv_buf = kz_pool_get(cons->recv_pool, 0);
     cons->recv_len = 0;
+    cons->mode = CONSDRV_MODE_LINE;
     serial_init(cons->index);
+    // 割込みハンドラは使用するチャネルにのみ登録する(他のチャネルは別のドライバが使う)
+    kz_setintr(SOFTVEC_TYPE_SERINTR(cons->index), consdrv_intr[cons->index]);
     serial_intr_recv_enable(cons->index);
+    KZ_LOG3("consdrv: device %d on SCI%d, buffer %d", index, cons->index, n);
     break;
 
   case CONSDRV_CMD_WRITE:
@@ -127,24 +326,91 @@ static int consdrv_command(struct consreg *cons, kz_thread_id_t id,
     INTR_ENABLE;
     break;
 
+  case CONSDRV_CMD_WRITEV:
+    wv = (consdrv_writev_t *)(command - 1);
+    wv->done = 0;
+    wv->next = NULL;
+    wv->id = id;
+    wv->cur = 0;
+    wv->offset = 0;
+    INTR_DISABLE;
+    if (cons->wreq_head && (wv->flags & CONSDRV_WRITEV_FLAG_NONBLOCK)) {
+      req = wv; // 先に空き待ちの要求があるので、出力せずに戻す
+    } else {
+      if (cons->wreq_tail)
+        cons->wreq_tail->next = wv;
+      else
+        cons->wreq_head = wv;
+      cons->wreq_tail = wv;
+      req = writev_proceed(cons);
+    }
+    INTR_ENABLE;
+    // 完了した要求の領域はもう参照しないので、要求元を起こす
+    while (req) {
+      wv = req->next;
+      kz_wakeup(req->id);
+      req = wv;
+    }
+    break;
+
+  case CONSDRV_CMD_MODE:
+    INTR_DISABLE;
+    cons->mode = (command[1] == CONSDRV_MODE_RAW) ? CONSDRV_MODE_RAW : CONSDRV_MODE_LINE;
+    cons->chunk = (unsigned char)command[2];
+    if ((cons->chunk < 1) || (cons->chunk > cons->buf_mask))
+      cons->chunk = cons->buf_mask;
+    cons->idle = (unsigned char)command[3] / TIMER_TICK_MSEC;
+    cons->idle_count = 0;
+    cons->recv_len = 0; // 切り替え前の受信データは捨てる
+    burst_setup(cons);
+    INTR_ENABLE;
+    break;
+
+  case CONSDRV_CMD_CONFIG:
+    baud = ((long)(uint8)command[1] << 24) | ((long)(uint8)command[2] << 16) |
+           ((long)(uint8)command[3] << 8) | (uint8)command[4];
+    // 送信バッファが空になるまで待ってから切り替える(送信は割込み処理で進む)
+    while (*(volatile int *)&cons->send_head != cons->send_tail)
+      ;
+    serial_config(cons->index, baud, command[5]);
+    INTR_DISABLE;
+    burst_setup(cons);
+    INTR_ENABLE;
+    break;
+
   default:
     break;
   }
   return 0;
 }
 
+// 受信したバッファを返却する(読み出し側のスレッドから呼ぶ)
+int consdrv_release(char *buf) {
+  int i;
+
+  for (i = 0; i < CONSDRV_DEVICE_NUM; i++) {
+    if ((buf >= recv_area[i]) && (buf < recv_area[i] + sizeof(recv_area[i])))
+      return kz_pool_put(consreg[i].recv_pool, buf);
+  }
+  return -1;
+}
+
 int consdrv_main(int argc, char *argv[]) {
   int size, index;
   kz_thread_id_t id;
   char *p;
 
   consdrv_init();
-  kz_setintr(SOFTVEC_TYPE_SERINTR, consdrv_intr);
+  timer_add_handler(consdrv_tick);
 
   while (1) {
     id = kz_recv(MSGBOX_ID_CONSOUTPUT, &size, &p);
     index = p[0] - '0';
     consdrv_command(&consreg[index], id, index, size - 1, p + 1);
-    kz_kmfree(p);
+    if (p[1] != CONSDRV_CMD_WRITEV) // 複数領域の出力要求は要求元の領域なので解放しない
+      kz_kmfree(p);
   }
 }
+
+// コンソールドライバスレッド(起動時にkz_start()が生成する)
+KZ_THREAD_DEFINE(consdrv, consdrv_main, 1, 0x200);
@@ -1,8 +1,44 @@
 #ifndef _CONSDRV_H_INCLUDED_
 #define _CONSDRV_H_INCLUDED_
 
-#define CONSDRV_DEVICE_NUM 1
-#define CONSDRV_CMD_USE 'u'
-#define CONSDRV_CMD_WRITE 'w'
+#define CONSDRV_DEVICE_NUM 3
+#define CONSDRV_CMD_USE 'u' // 使用開始(シリアル番号, バッファサイズ(省略可, 2バイト))
+#define CONSDRV_CMD_WRITE 'w' // 送信バッファに入りきらない分は捨てる(待たせる場合はWRITEVを使う)
+#define CONSDRV_CMD_CONFIG 'c' // ボーレート(4バイト)と通信フォーマットの設定
+#define CONSDRV_CMD_MODE 'm' // 入出力モード, 通知単位(バイト), 通知タイムアウト(ミリ秒)
+#define CONSDRV_CMD_WRITEV 'v' // 複数領域の出力(consdrv_writev_tを参照)
+
+#define CONSDRV_MODE_LINE 'l' // 行単位で通知。エコーバックと改行コード変換を行う
+#define CONSDRV_MODE_RAW 'r' // 無変換で、通知単位ごとか受信が途切れたところで通知
+
+#define CONSDRV_WRITEV_SEG_NUM 2
+
+#define CONSDRV_WRITEV_FLAG_NONBLOCK (1<<0) // 送信バッファの空き分だけ出力してすぐに戻る
+
+// 複数領域の出力要求。
+// 要求とデータは送信元の領域のまま参照するので、ドライバは解放せず、
+// 送信バッファにコピーし終えたところでkz_wakeup()で送信元を起こす。
+// 送信バッファが一杯なら、送信割込みで空きができるたびに続きをコピーする。
+// 送信元はkz_send()の後にkz_sleep()で完了を待つこと。
+typedef struct _consdrv_writev {
+  char device; // '0' + デバイス番号
+  char cmd; // CONSDRV_CMD_WRITEV
+  char num; // 領域の数
+  char flags; // CONSDRV_WRITEV_FLAG_*
+  struct {
+    char *p;
+    int size;
+  } seg[CONSDRV_WRITEV_SEG_NUM];
+  int done; // 出力できたバイト数(完了時に設定される)
+
+  // 以下はドライバが使用する
+  struct _consdrv_writev *next;
+  kz_thread_id_t id;
+  int cur; // コピー中の領域
+  int offset; // コピー中の領域内の位置
+} consdrv_writev_t;
+
+// 受信したバッファの返却(MSGBOX_ID_CONSINPUTで受け取ったバッファは、解放せずにこれで返す)
+int consdrv_release(char *buf);
 
 #endif
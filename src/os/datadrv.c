@@ -0,0 +1,201 @@
+#include "defines.h"
+#include "kozos.h"
+#include "intr.h"
+#include "interrupt.h"
+#include "serial.h"
+#include "lib.h"
+#include "klog.h"
+#include "datadrv.h"
+
+// 受信用のフレーム・バッファ(2面)。割込み処理が一方に受信している間に、
+// もう一方を受信スレッドが処理できる。
+#define DATADRV_RXBUF_NUM 2
+
+static char rxarea[KZ_POOL_BUFFER_SIZE(DATADRV_FRAME_SIZE, DATADRV_RXBUF_NUM)];
+
+KZ_MSGBOX_DEFINE(datainput); // 受信フレーム
+KZ_MSGBOX_DEFINE(dataoutput); // ドライバへの要求
+KZ_MSGBOX_DEFINE(datasent); // 送信完了の通知
+
+static struct datareg {
+  kz_thread_id_t id; // ドライバを利用するスレッド
+  int index; // 利用するシリアルの番号
+  int flags;
+
+  datadrv_req *send_head; // 送信待ちの要求のキュー
+  datadrv_req *send_tail;
+  datadrv_req *send_cur; // 送信中の要求
+  cobs_encoder enc;
+
+  kz_pool_id_t rxpool; // 受信フレーム・バッファのプール
+  char *recv_buf; // 受信中のフレーム・バッファ(空きがなければNULL)
+  cobs_decoder dec;
+  int recv_error; // CRC不一致などで破棄したフレーム数
+  int recv_drop; // バッファが無く破棄したフレーム数
+} datareg;
+
+// 受信バッファを獲得する。
+// 割込み処理からはサービスコール、スレッド(ループバック時)からはシステムコールを使う。
+static void recv_getbuf(struct datareg *dr, int intr) {
+  dr->recv_buf = intr ? kx_pool_get(dr->rxpool) : kz_pool_get(dr->rxpool, 0);
+  if (dr->recv_buf)
+    cobs_decode_init(&dr->dec, dr->recv_buf, DATADRV_FRAME_SIZE);
+}
+
+// 受信した1バイトを処理する
+static void recv_byte(struct datareg *dr, unsigned char c, int intr) {
+  int len;
+
+  if (!dr->recv_buf) {
+    // 受信スレッドがバッファを返却するまで、フレームの区切りで再取得を試みる
+    if (c == 0) {
+      recv_getbuf(dr, intr);
+      if (!dr->recv_buf)
+        dr->recv_drop++;
+    }
+    return;
+  }
+
+  len = cobs_decode_byte(&dr->dec, c);
+  if (len > 0) {
+    // 受信したフレームを通知し、次の受信バッファを用意する
+    if (intr)
+      kx_send(MSGBOX_ID_DATAINPUT, len, dr->recv_buf);
+    else
+      kz_send(MSGBOX_ID_DATAINPUT, len, dr->recv_buf);
+    recv_getbuf(dr, intr);
+  } else if (len < 0) {
+    dr->recv_error++;
+    if (intr)
+      KX_LOG1("datadrv: bad frame (errors=%d)", dr->recv_error);
+    else
+      KZ_LOG1("datadrv: bad frame (errors=%d)", dr->recv_error);
+  }
+}
+
+// 送信キューの先頭の要求の送信を始める(割込み禁止状態で呼ぶこと)
+static void send_start(struct datareg *dr) {
+  dr->send_cur = dr->send_head;
+  if (!dr->send_cur)
+    return;
+  dr->send_head = dr->send_cur->next;
+  if (!dr->send_head)
+    dr->send_tail = NULL;
+  cobs_encode_init(&dr->enc, dr->send_cur->buf, dr->send_cur->size,
+                   dr->send_cur->crc);
+}
+
+// 次の1バイトを送信する。送信するものが無ければ0を返す(割込み処理から呼ぶ)
+static int send_byte(struct datareg *dr) {
+  int c;
+
+  while (dr->send_cur) {
+    c = cobs_encode_byte(&dr->enc);
+    if (c >= 0) {
+      serial_send_byte(dr->index, c);
+      return 1;
+    }
+    // 送信が完了したら要求元に返却し、次の要求に移る
+    kx_send(MSGBOX_ID_DATASENT, dr->send_cur->size, (char *)dr->send_cur);
+    send_start(dr);
+  }
+  return 0;
+}
+
+static void datadrv_intr(void) {
+  struct datareg *dr = &datareg;
+
+  if (!dr->id)
+    return;
+
+  if (serial_is_recv_enable(dr->index))
+    recv_byte(dr, serial_recv_byte(dr->index), 1);
+
+  if (serial_is_send_enable(dr->index)) {
+    if (!send_byte(dr))
+      serial_intr_send_disable(dr->index);
+  }
+}
+
+// ループバック時は、エンコードしたフレームをそのままデコーダに渡す
+static void send_loopback(struct datareg *dr, datadrv_req *req) {
+  int c;
+
+  cobs_encode_init(&dr->enc, req->buf, req->size, req->crc);
+  while ((c = cobs_encode_byte(&dr->enc)) >= 0)
+    recv_byte(dr, c, 0);
+
+  kz_send(MSGBOX_ID_DATASENT, req->size, (char *)req);
+}
+
+// 初期化処理
+static int datadrv_init(void) {
+  memset(&datareg, 0, sizeof(datareg));
+  return 0;
+}
+
+// スレッドからの要求を処理する
+static int datadrv_command(struct datareg *dr, kz_thread_id_t id,
+                           datadrv_req *req) {
+  switch (req->cmd) {
+  case DATADRV_CMD_USE:
+    dr->id = id;
+    dr->index = req->index;
+    dr->flags = req->flags;
+    dr->rxpool = kz_pool_create(rxarea, sizeof(rxarea), DATADRV_FRAME_SIZE);
+    dr->recv_buf = kz_pool_get(dr->rxpool, 0);
+    cobs_decode_init(&dr->dec, dr->recv_buf, DATADRV_FRAME_SIZE);
+    if (!(dr->flags & DATADRV_FLAG_LOOPBACK)) {
+      serial_init(dr->index);
+      kz_setintr(SOFTVEC_TYPE_SERINTR(dr->index), datadrv_intr);
+      serial_intr_recv_enable(dr->index);
+    }
+    break;
+
+  case DATADRV_CMD_SEND:
+    // CRCはスレッド側で計算しておき、割込み処理ではエンコードのみ行う
+    req->crc = crc16(0, req->buf, req->size);
+    req->next = NULL;
+    if (dr->flags & DATADRV_FLAG_LOOPBACK) {
+      send_loopback(dr, req);
+      break;
+    }
+    INTR_DISABLE;
+    if (dr->send_tail) {
+      dr->send_tail->next = req;
+    } else {
+      dr->send_head = req;
+    }
+    dr->send_tail = req;
+    if (!dr->send_cur) { // 送信中でなければ送信を開始する
+      send_start(dr);
+      serial_intr_send_enable(dr->index);
+      send_byte(dr);
+    }
+    INTR_ENABLE;
+    break;
+
+  default:
+    break;
+  }
+  return 0;
+}
+
+int datadrv_release(char *frame) {
+  return kz_pool_put(datareg.rxpool, frame);
+}
+
+int datadrv_main(int argc, char *argv[]) {
+  kz_thread_id_t id;
+  char *p;
+
+  datadrv_init();
+
+  while (1) {
+    id = kz_recv(MSGBOX_ID_DATAOUTPUT, NULL, &p);
+    datadrv_command(&datareg, id, (datadrv_req *)p);
+  }
+}
+
+// バイナリ転送ドライバスレッド(起動時にkz_start()が生成する)
+KZ_THREAD_DEFINE(datadrv, datadrv_main, 1, 0x200);
@@ -0,0 +1,30 @@
+#ifndef _DATADRV_H_INCLUDED_
+#define _DATADRV_H_INCLUDED_
+
+// バイナリ転送ドライバ
+// COBSでフレーム化し、CRC-16を付加してシリアルで送受信する。
+
+#define DATADRV_FRAME_SIZE 128 // 受信フレームの最大長(CRCを含む)
+
+#define DATADRV_CMD_USE 'u' // 使用開始
+#define DATADRV_CMD_SEND 's' // フレーム送信
+
+#define DATADRV_FLAG_LOOPBACK (1<<0) // 送信フレームを受信側に折り返す(試験用)
+
+// ドライバへの要求(MSGBOX_ID_DATAOUTPUTに送る)
+// 送信要求のbufはコピーされずに割込み処理から直接送信されるため、
+// 完了がMSGBOX_ID_DATASENTに通知されるまで要求ともども変更してはならない。
+typedef struct _datadrv_req {
+  char cmd; // DATADRV_CMD_*
+  char index; // 使用開始: SCIの番号
+  int flags; // 使用開始: DATADRV_FLAG_*
+  char *buf; // 送信: データ
+  int size; // 送信: データ長
+  struct _datadrv_req *next; // 以下はドライバが使用
+  uint16 crc;
+} datadrv_req;
+
+// 受信フレーム(MSGBOX_ID_DATAINPUTで受け取ったもの)をドライバに返却する
+int datadrv_release(char *frame);
+
+#endif
@@ -9,13 +9,11 @@ typedef unsigned short uint16;
 typedef unsigned long uint32;
 
 typedef uint32 kz_thread_id_t; // スレッドID
+typedef uint32 kz_pool_id_t; // メモリプールID
 typedef int (*kz_func_t)(int argc, char *argv[]); // スレッドのメイン関数の型
 typedef void (*kz_handler_t)(void); // 割込みハンドラの型
 
-typedef enum {
-  MSGBOX_ID_CONSINPUT = 0, // コンソールからの入力
-  MSGBOX_ID_CONSOUTPUT, // コンソールへの出力
-  MSGBOX_ID_NUM
-} kz_msgbox_id_t;
+// メッセージボックスID(KZ_MSGBOX_DEFINE()で定義したメッセージボックスを指す)
+typedef struct _kz_msgbox *kz_msgbox_id_t;
 
 #endif
@@ -1,10 +1,14 @@
 #ifndef _INTR_H_INCLUDED_
 #define _INTR_H_INCLUDED_
 
-#define SOFTVEC_TYPE_NUM 3 // ソフトウェア・割り込みベクタの種別の個数
+#define SOFTVEC_TYPE_NUM 6 // ソフトウェア・割り込みベクタの種別の個数
 
 #define SOFTVEC_TYPE_SOFTERR 0 // ソフトウェア・エラー
 #define SOFTVEC_TYPE_SYSCALL 1 // システム・コール
-#define SOFTVEC_TYPE_SERINTR 2 // シリアル割込み
+#define SOFTVEC_TYPE_SERINTR0 2 // シリアル割込み(SCI0)
+#define SOFTVEC_TYPE_SERINTR1 3 // シリアル割込み(SCI1)
+#define SOFTVEC_TYPE_SERINTR2 4 // シリアル割込み(SCI2)
+#define SOFTVEC_TYPE_SERINTR(index) (SOFTVEC_TYPE_SERINTR0 + (index))
+#define SOFTVEC_TYPE_TIMINTR 5 // タイマ割込み
 
 #endif
@@ -0,0 +1,105 @@
+#include "defines.h"
+#include "interrupt.h"
+#include "serial.h"
+#include "timer.h"
+#include "lib.h"
+#include "klog.h"
+
+static char klog_buf[KLOG_BUFFER_SIZE];
+static volatile int klog_head; // 読み出し位置(読み出し側のみ更新する)
+static volatile int klog_tail; // 書き込み位置(書き込み側のみ更新する)
+static int klog_drop; // 溢れて捨てた文字数
+static int klog_record_on; // バイナリ形式の記録を書き込むか(既定は捨てる)
+
+#define KLOG_MASK (KLOG_BUFFER_SIZE - 1)
+
+// リングの空きサイズ
+#define KLOG_SPACE(tail) (KLOG_MASK - (((tail) - klog_head) & KLOG_MASK))
+
+// リングにはそのまま送信できる形で格納するので、改行は"\r\n"にしておく
+void klog_puts(char *str) {
+  int tail = klog_tail;
+
+  for (; *str; str++) {
+    if (KLOG_SPACE(tail) < ((*str == '\n') ? 2 : 1)) {
+      klog_drop++;
+      continue;
+    }
+    if (*str == '\n') {
+      klog_buf[tail] = '\r';
+      tail = (tail + 1) & KLOG_MASK;
+    }
+    klog_buf[tail] = *str;
+    tail = (tail + 1) & KLOG_MASK;
+  }
+  klog_tail = tail; // 書き込み終えてから公開する
+}
+
+void klog_record(int intr, const char *format, int nargs, long a1, long a2, long a3) {
+  char rec[2 + 4 + 4 * KLOG_ARGS_MAX];
+  long args[KLOG_ARGS_MAX];
+  uint16 id;
+  uint32 ticks;
+  cobs_encoder enc;
+  int len, tail, c;
+
+  if (!klog_record_on)
+    return;
+
+  // 書式文字列のアドレス(.kzlogセクション内のオフセット)がID
+  id = (uint16)(uint32)format;
+  ticks = timer_get_ticks();
+  args[0] = a1;
+  args[1] = a2;
+  args[2] = a3;
+  memcpy(rec, &id, 2);
+  memcpy(rec + 2, &ticks, 4);
+  memcpy(rec + 6, args, 4 * nargs);
+  len = 6 + 4 * nargs;
+  cobs_encode_init(&enc, rec, len, crc16(0, rec, len));
+
+  // スレッドからは割込みを禁止して、カーネルの書き込みと排他する
+  if (!intr)
+    INTR_DISABLE;
+  tail = klog_tail;
+  // 前の0x00、コード・バイト、CRC、後ろの0x00の分を加えた空きがなければ捨てる
+  // (途中で切れた記録をリングに残さない)
+  if (KLOG_SPACE(tail) < len + 5) {
+    klog_drop++;
+  } else {
+    klog_buf[tail] = 0;
+    tail = (tail + 1) & KLOG_MASK;
+    while ((c = cobs_encode_byte(&enc)) >= 0) {
+      klog_buf[tail] = c;
+      tail = (tail + 1) & KLOG_MASK;
+    }
+    klog_tail = tail;
+  }
+  if (!intr)
+    INTR_ENABLE;
+}
+
+void klog_record_enable(int enable) {
+  klog_record_on = enable;
+}
+
+int klog_getc(void) {
+  int c;
+
+  if (klog_head == klog_tail)
+    return -1;
+  c = (unsigned char)klog_buf[klog_head];
+  klog_head = (klog_head + 1) & KLOG_MASK;
+  return c;
+}
+
+int klog_pending(void) {
+  return (klog_tail - klog_head) & KLOG_MASK;
+}
+
+void klog_flush(void) {
+  int c;
+
+  while ((c = klog_getc()) >= 0)
+    serial_send_byte(SERIAL_DEFAULT_DEVICE, c);
+}
@@ -0,0 +1,42 @@
+#ifndef _KLOG_H_INCLUDED_
+#define _KLOG_H_INCLUDED_
+
+#define KLOG_BUFFER_SIZE 256 // 2の累乗
+
+// カーネルのメッセージをリングバッファに書き込む(溢れた分は捨てる)。
+// 書き込み側はカーネル(割込み禁止状態)のみ、読み出し側はコンソールドライバのみ
+// なので、ロックなしで操作できる。
+void klog_puts(char *str);
+int klog_getc(void); // 読み出すデータが無ければ-1を返す
+int klog_pending(void); // 読み出せるデータのバイト数
+// 溜まっているメッセージをポーリングで出力する(システムダウン時用)
+void klog_flush(void);
+
+// バイナリ形式のログ。書式文字列はロードされない.kzlogセクションに置き、
+// そのオフセットをIDとして、タイムスタンプと引数だけを記録する。
+// 記録はCOBSでエンコードし(CRC付き)、0x00で前後を区切ってリングに書き込む。
+// 書式はホスト側のtools/kzlog.pyで、kozos.elfから取り出した辞書を使って復元する。
+// (書式文字列はターゲット上では参照できないので、%sは使えない)
+#define KLOG_ARGS_MAX 3
+
+// 記録はテキストのログと同じくシェルのコンソールに流れるので、既定では捨てる。
+// kzlog.pyで受信するときだけ、commandの"klog on"で有効にする。
+void klog_record(int intr, const char *format, int nargs, long a1, long a2, long a3);
+void klog_record_enable(int enable);
+
+#define KLOG_FORMAT(format) ({ \
+  static const char _klog_format[] __attribute__((section(".kzlog"))) = format; \
+  _klog_format; })
+
+// スレッドから呼ぶ場合
+#define KZ_LOG0(f)          klog_record(0, KLOG_FORMAT(f), 0, 0, 0, 0)
+#define KZ_LOG1(f, a)       klog_record(0, KLOG_FORMAT(f), 1, (long)(a), 0, 0)
+#define KZ_LOG2(f, a, b)    klog_record(0, KLOG_FORMAT(f), 2, (long)(a), (long)(b), 0)
+#define KZ_LOG3(f, a, b, c) klog_record(0, KLOG_FORMAT(f), 3, (long)(a), (long)(b), (long)(c))
+// カーネルや割込み処理から呼ぶ場合
+#define KX_LOG0(f)          klog_record(1, KLOG_FORMAT(f), 0, 0, 0, 0)
+#define KX_LOG1(f, a)       klog_record(1, KLOG_FORMAT(f), 1, (long)(a), 0, 0)
+#define KX_LOG2(f, a, b)    klog_record(1, KLOG_FORMAT(f), 2, (long)(a), (long)(b), 0)
+#define KX_LOG3(f, a, b, c) klog_record(1, KLOG_FORMAT(f), 3, (long)(a), (long)(b), (long)(c))
+
+#endif
@@ -5,10 +5,13 @@
 #include "syscall.h"
 #include "memory.h"
 #include "lib.h"
+#include "klog.h"
+#include "bootrec.h"
 
 #define THREAD_NUM 6
 #define PRIORITY_NUM 16
 #define THREAD_NAME_SIZE 15
+#define MSGBUF_NUM 24 // 同時に送信待ちにできるメッセージの数
 
 typedef struct _kz_context {
   uint32 sp;
@@ -19,8 +22,13 @@ typedef struct _kz_thread {
   char name[THREAD_NAME_SIZE + 1];
   int priority;
   char *stack;
+  int stacksize; // スタックの大きさ(終了後もTCBに残し、次のスレッドで再利用する)
   uint32 flags;
   #define KZ_THREAD_FLAG_READY (1 << 0)
+  #define KZ_THREAD_FLAG_SLEEP (1 << 1) // kz_sleep()で眠っている
+  #define KZ_THREAD_FLAG_WAKEUP (1 << 2) // 眠る前にkz_wakeup()された(起床の保留)
+  int memblocks; // 獲得して未解放の動的メモリのブロック数
+  void *writer; // kz_printf()の出力先
   struct { // スレッドのスタートアップに渡すパラメータ
     kz_func_t func; // スレッドのメイン関数
     int argc;
@@ -45,15 +53,17 @@ typedef struct _kz_msgbuf {
   } param;
 } kz_msgbuf;
 
-/* メッセージ・ボックス */
-typedef struct _kz_msgbox {
-  kz_thread *receiver;
-  kz_msgbuf *head;
-  kz_msgbuf *tail;
+/* メッセージ・ボックス(kozos.hのKZ_MSGBOX_DEFINE()で定義する) */
+typedef kz_msgbox_t kz_msgbox;
 
-  /* 構造体のサイズが2の累乗になるように調整 */
-  long dummy[1];
-} kz_msgbox;
+/* ユーザー定義の固定長メモリプール(管理領域は呼び出し元の領域の先頭に置く) */
+typedef struct _kz_pool {
+  int size;                     /* ブロックサイズ */
+  int num;                      /* ブロック数 */
+  char *free;                   /* 空きブロックのリスト(リンクはブロック先頭に格納) */
+  kz_thread *waiter_head;       /* 空き待ちスレッドのキュー */
+  kz_thread *waiter_tail;
+} kz_pool;
 
 static struct {
   kz_thread *head;
@@ -63,7 +73,9 @@ static struct {
 static kz_thread *current; // 現在実行中のスレッド
 static kz_thread threads[THREAD_NUM];
 static kz_handler_t handlers[SOFTVEC_TYPE_NUM];
-static kz_msgbox msgboxes[MSGBOX_ID_NUM];
+/* メッセージ・バッファは共有の動的メモリを使わず、専用の空きリストから取る */
+static kz_msgbuf msgbufs[MSGBUF_NUM];
+static kz_msgbuf *msgbuf_free;
 
 // スレッドのディスパッチ(実体はstartup.sに)
 void dispatch(kz_context *context);
@@ -130,26 +142,16 @@ static void thread_init(kz_thread *thp) {
   thread_end();
 }
 
-static kz_thread_id_t thread_run(kz_func_t func,
-                                 char *name,
-                                 int priority,
-                                 int stacksize,
-                                 int argc,
-                                 char *argv[]) {
-  int i;
-  kz_thread *thp;
+// TCBとスタックの初期フレームを設定する
+static void thread_setup(kz_thread *thp,
+                         kz_func_t func,
+                         char *name,
+                         int priority,
+                         char *stack,
+                         int stacksize,
+                         int argc,
+                         char *argv[]) {
   uint32 *sp;
-  extern char userstack; // リンカ・スクリプトで定義されるスタック領域
-  static char *thread_stack = &userstack; // ユーザー・スタックに利用される領域
-
-  // 空いているTCB(タスク・コントロール・ブロック)を検索
-  for (i = 0; i < THREAD_NUM; i++) {
-    thp = &threads[i];
-    if (!thp->init.func)
-      break;
-  }
-  if (i == THREAD_NUM)
-    return -1;
 
   memset(thp, 0, sizeof(*thp)); // TCBをゼロクリア
 
@@ -162,11 +164,8 @@ static kz_thread_id_t thread_run(kz_func_t func,
   thp->init.argc = argc;
   thp->init.argv = argv;
 
-  // スタック領域を獲得
-  memset(thread_stack, 0, stacksize);
-  thread_stack += stacksize;
-  
-  thp->stack = thread_stack;
+  thp->stack = stack;
+  thp->stacksize = stacksize;
 
   // スタックの初期化
   sp = (uint32 *)thp->stack;
@@ -189,6 +188,51 @@ static kz_thread_id_t thread_run(kz_func_t func,
   *(--sp) = (uint32)thp; // ER0
 
   thp->context.sp = (uint32)sp;
+}
+
+static kz_thread_id_t thread_run(kz_func_t func,
+                                 char *name,
+                                 int priority,
+                                 int stacksize,
+                                 int argc,
+                                 char *argv[]) {
+  int i;
+  kz_thread *thp = NULL;
+  char *stack;
+  extern char userstack, userstack_end; // リンカ・スクリプトで定義されるスタック領域
+  static char *thread_stack = &userstack; // ユーザー・スタックに利用される領域
+
+  // 空いているTCB(タスク・コントロール・ブロック)を検索する。
+  // 終了したスレッドのスタックが足りるならそのTCBを優先し、スタックを使い回す。
+  for (i = 0; i < THREAD_NUM; i++) {
+    if (threads[i].init.func)
+      continue;
+    if (threads[i].stack && (threads[i].stacksize >= stacksize)) {
+      thp = &threads[i];
+      break;
+    }
+    if (!thp || (thp->stack && !threads[i].stack))
+      thp = &threads[i];
+  }
+  if (!thp)
+    return -1;
+
+  if (thp->stack && (thp->stacksize >= stacksize)) {
+    stack = thp->stack;
+    stacksize = thp->stacksize;
+  } else {
+    // スタック領域がブート・スタックと衝突する場合はエラー
+    if (thread_stack + stacksize > &userstack_end)
+      return -1;
+    thread_stack += stacksize;
+    stack = thread_stack;
+  }
+
+  // スタック領域を獲得
+  memset(stack - stacksize, 0, stacksize);
+  thread_setup(thp, func, name, priority, stack, stacksize, argc, argv);
+
+  KX_LOG3("thread run id=%08lx pri=%d stack=%04x", thp, priority, stacksize);
 
   // システム・コールを呼び出したスレッドをレディ・キューに戻す
   putcurrent();
@@ -202,9 +246,18 @@ static kz_thread_id_t thread_run(kz_func_t func,
 
 // スレッドの終了。
 static int thread_exit(void) {
-  puts(current->name);
-  puts(" EXIT.\n");
+  char *stack;
+  int stacksize;
+
+  // ポーリングで出力すると送信完了まで止まってしまうので、ログに書いておく
+  klog_puts(current->name);
+  klog_puts(" EXIT.\n");
+  stack = current->stack;
+  stacksize = current->stacksize;
   memset(current, 0, sizeof(*current));
+  // スタックは次に同じTCBを使うスレッドのために残しておく
+  current->stack = stack;
+  current->stacksize = stacksize;
   return 0;
 }
 
@@ -216,6 +269,13 @@ static int thread_wait(void) {
 
 // スレッドのスリープ。
 static int thread_sleep(void) {
+  // 先にkz_wakeup()されていれば、眠らずにそのまま戻る。
+  if (current->flags & KZ_THREAD_FLAG_WAKEUP) {
+    current->flags &= ~KZ_THREAD_FLAG_WAKEUP;
+    putcurrent();
+    return 0;
+  }
+  current->flags |= KZ_THREAD_FLAG_SLEEP;
   return 0; // レディ・キューから外されたままになるので、スケジューリングされなくなる。
 }
 
@@ -223,7 +283,13 @@ static int thread_wakeup(kz_thread_id_t id) {
   putcurrent();
 
   current = (kz_thread *)id;
-  putcurrent();
+  if (current->flags & KZ_THREAD_FLAG_SLEEP) {
+    current->flags &= ~KZ_THREAD_FLAG_SLEEP;
+    putcurrent();
+  } else {
+    // まだ眠っていない(またはメッセージ待ちなどの)場合は、次のkz_sleep()まで保留する
+    current->flags |= KZ_THREAD_FLAG_WAKEUP;
+  }
 
   return 0;
 }
@@ -245,20 +311,50 @@ static int thread_chpri(int priority) {
 
 static void *thread_kzmalloc(int size) {
   putcurrent();
-  return kzmem_alloc(size);
+  if (current) // 割込み処理からの獲得はカーネルの所有とする
+    current->memblocks++;
+  return kzmem_alloc(size, (kz_thread_id_t)current);
 }
 
 static int thread_kmfree(char *p) {
-  kzmem_free(p);
+  kz_thread *owner;
+
+  // 獲得したスレッドの使用数を減らす。
+  // 既に終了したスレッドのTCBは再利用されている可能性があるため、負にはしない。
+  owner = (kz_thread *)kzmem_free(p);
+  if (owner && owner->memblocks > 0)
+    owner->memblocks--;
+  putcurrent();
+  return 0;
+}
+
+static int thread_memstat(int index, kz_memstat_t *stat) {
+  putcurrent();
+  return kzmem_getstat(index, stat);
+}
+
+static int thread_thstat(int index, kz_thstat_t *stat) {
+  kz_thread *thp;
+
   putcurrent();
+  if (index < 0 || index >= THREAD_NUM)
+    return -1;
+
+  thp = &threads[index];
+  stat->id        = thp->init.func ? (kz_thread_id_t)thp : 0;
+  stat->name      = thp->name;
+  stat->priority  = thp->priority;
+  stat->memblocks = thp->memblocks;
+
   return 0;
 }
 
 static void sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p) {
   kz_msgbuf *mp;
-  mp = (kz_msgbuf *)kzmem_alloc(sizeof(*mp));
+  mp = msgbuf_free;
   if (mp == NULL)
     kz_sysdown();
+  msgbuf_free = mp->next;
   /* パラメータ設定 */
   mp->next       = NULL;
   mp->sender     = thp;
@@ -297,12 +393,13 @@ static void recvmsg(kz_msgbox *mboxp) {
   /* 受信待ちスレッドの登録を解除 */
   mboxp->receiver = NULL;
 
-  /* メッセージバッファの解放 */
-  kzmem_free(mp);
+  /* メッセージバッファを空きリストに戻す */
+  mp->next = msgbuf_free;
+  msgbuf_free = mp;
 }
 
 static int thread_send(kz_msgbox_id_t id, int size, char*p) {
-  kz_msgbox *mboxp = &msgboxes[id];
+  kz_msgbox *mboxp = id;
 
   putcurrent();
   sendmsg(mboxp, current, size, p);
@@ -318,7 +415,7 @@ static int thread_send(kz_msgbox_id_t id, int size, char*p) {
 }
 
 static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp) {
-  kz_msgbox *mboxp = &msgboxes[id];
+  kz_msgbox *mboxp = id;
 
   /* 他のスレッドが既に受信待ち */
   if (mboxp->receiver)
@@ -337,6 +434,95 @@ static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp) {
   return current->syscall.param->un.recv.ret;
 }
 
+////////////////////////////////////////
+// ユーザー定義メモリプール
+////////////////////////////////////////
+
+static kz_pool_id_t thread_pool_create(char *buf, int bufsize, int blksize) {
+  kz_pool *pp;
+  char *p;
+  int i;
+
+  putcurrent();
+
+  /* 管理領域とブロックは4バイト境界に合わせる */
+  p = (char *)(((uint32)buf + 3) & ~3);
+  bufsize -= p - buf;
+  blksize = (blksize + 3) & ~3;
+  if (blksize < sizeof(char *))
+    blksize = sizeof(char *);
+  if (sizeof(*pp) > KZ_POOL_HEADER_SIZE ||
+      bufsize < KZ_POOL_HEADER_SIZE + blksize)
+    return 0;
+
+  pp = (kz_pool *)p;
+  pp->size = blksize;
+  pp->num = (bufsize - KZ_POOL_HEADER_SIZE) / blksize;
+  pp->waiter_head = NULL;
+  pp->waiter_tail = NULL;
+
+  /* 空きリストをアドレス順に作成する */
+  p += KZ_POOL_HEADER_SIZE;
+  pp->free = p;
+  for (i = 0; i < pp->num - 1; i++) {
+    *(char **)p = p + blksize;
+    p += blksize;
+  }
+  *(char **)p = NULL;
+
+  return (kz_pool_id_t)pp;
+}
+
+static void *thread_pool_get(kz_pool_id_t id, int wait) {
+  kz_pool *pp = (kz_pool *)id;
+  char *p;
+
+  p = pp->free;
+  if (p) { /* 空きリストの先頭を取り出す */
+    pp->free = *(char **)p;
+    putcurrent();
+    return p;
+  }
+
+  /* 空きが無い場合、待ち指定があれば解放されるまでスリープする */
+  if (wait && current) {
+    current->next = NULL;
+    if (pp->waiter_tail) {
+      pp->waiter_tail->next = current;
+    } else {
+      pp->waiter_head = current;
+    }
+    pp->waiter_tail = current;
+    return NULL;
+  }
+
+  putcurrent();
+  return NULL;
+}
+
+static int thread_pool_put(kz_pool_id_t id, void *p) {
+  kz_pool *pp = (kz_pool *)id;
+  kz_thread *thp;
+
+  putcurrent();
+
+  thp = pp->waiter_head;
+  if (thp) { /* 空き待ちスレッドがいれば、ブロックを直接渡して起床させる */
+    pp->waiter_head = thp->next;
+    if (pp->waiter_head == NULL)
+      pp->waiter_tail = NULL;
+    thp->next = NULL;
+    thp->syscall.param->un.poolget.ret = p;
+    current = thp;
+    putcurrent();
+  } else {
+    *(char **)p = pp->free;
+    pp->free = p;
+  }
+
+  return 0;
+}
+
 ////////////////////////////////////////
 // システムコールの処理(kx_setintr():割込みハンドラ登録)
 ////////////////////////////////////////
@@ -405,6 +591,23 @@ static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *p) {
   case KZ_SYSCALL_TYPE_SETINTR:  /* kz_setintr */
     p->un.setintr.ret = thread_setintr(p->un.setintr.type, p->un.setintr.handler);
     break;
+  case KZ_SYSCALL_TYPE_POOLCRE: /* kz_pool_create() */
+    p->un.poolcre.ret = thread_pool_create(p->un.poolcre.buf,
+                                           p->un.poolcre.bufsize,
+                                           p->un.poolcre.blksize);
+    break;
+  case KZ_SYSCALL_TYPE_POOLGET: /* kz_pool_get() */
+    p->un.poolget.ret = thread_pool_get(p->un.poolget.id, p->un.poolget.wait);
+    break;
+  case KZ_SYSCALL_TYPE_POOLPUT: /* kz_pool_put() */
+    p->un.poolput.ret = thread_pool_put(p->un.poolput.id, p->un.poolput.p);
+    break;
+  case KZ_SYSCALL_TYPE_MEMSTAT: /* kz_memstat() */
+    p->un.memstat.ret = thread_memstat(p->un.memstat.index, p->un.memstat.stat);
+    break;
+  case KZ_SYSCALL_TYPE_THSTAT: /* kz_thstat() */
+    p->un.thstat.ret = thread_thstat(p->un.thstat.index, p->un.thstat.stat);
+    break;
   default:
     break;
   }
@@ -448,8 +651,8 @@ static void syscall_intr(void) {
 
 // ソフトウェアエラーの発生
 static void softerr_intr(void) {
-  puts(current->name);
-  puts(" DOWN.\n");
+  klog_puts(current->name);
+  klog_puts(" DOWN.\n");
   getcurrent(); // レディーキューから外す
   thread_exit(); // スレッドを終了する
 }
@@ -472,33 +675,80 @@ static void thread_intr(softvec_type_t type, unsigned long sp) {
 // 初期スレッドの起動
 ////////////////////////////////////////
 
+// 静的に定義されたスレッドの起動。
+// スタックはBSSなので初期化済みで、TCBの検索もスタックの獲得も不要
+static void thread_define(void) {
+  extern kz_thread_def_t kzthread_start, kzthread_end; // リンカ・スクリプトで定義される
+  kz_thread_def_t *def;
+  kz_thread *thp = threads;
+
+  for (def = &kzthread_start; def < &kzthread_end; def++, thp++) {
+    if (thp == &threads[THREAD_NUM])
+      kz_sysdown();
+    thread_setup(thp, def->func, def->name, def->priority,
+                 def->stack, def->stacksize, 0, NULL);
+    current = thp;
+    putcurrent();
+  }
+}
+
 void kz_start(kz_func_t func,
               char *name,
               int priority,
               int stacksize,
               int argc,
               char *argv[]) {
+  int i;
+  extern char kzmsgbox_start, kzmsgbox_end; // リンカ・スクリプトで定義される
+
+  bootrec_stamp(BOOTREC_KZ_START);
+
   kzmem_init();                 /* 動的メモリの初期化 */
   current = NULL;
 
   memset(readyque, 0, sizeof(readyque));
   memset(threads, 0, sizeof(threads));
   memset(handlers, 0, sizeof(handlers));
-  memset(msgboxes, 0, sizeof(msgboxes));
+  memset(&kzmsgbox_start, 0, &kzmsgbox_end - &kzmsgbox_start);
+
+  msgbuf_free = NULL;
+  for (i = 0; i < MSGBUF_NUM; i++) {
+    msgbufs[i].next = msgbuf_free;
+    msgbuf_free = &msgbufs[i];
+  }
 
   // 割込みハンドラの登録
   thread_setintr(SOFTVEC_TYPE_SYSCALL, syscall_intr);
   thread_setintr(SOFTVEC_TYPE_SOFTERR, softerr_intr);
 
+  // KZ_THREAD_DEFINE()で定義されたスレッドを、表の順にTCBを割り当てて起動する
+  thread_define();
+  current = NULL;
+
   current = (kz_thread *)thread_run(func, name, priority, stacksize, argc, argv);
 
+  bootrec_stamp(BOOTREC_DISPATCH);
   dispatch(&current->context);
   // ここには到達しない。
 }
 
+// kz_printf()の出力先の設定と取得(スレッドから呼ぶ。自スレッドのTCBのみ操作する)
+void kz_setwriter(void *writer) {
+  current->writer = writer;
+}
+
+void *kz_getwriter(void) {
+  return current->writer;
+}
+
 // 致命的なエラーが発生した場合
 void kz_sysdown(void) {
+  // 割込みによる出力はもう期待できないので、溜まっているログを先に直接出力する。
+  // ログのリングが一杯でも失われないように、以降はリングを通さずに出力する。
+  INTR_DISABLE;
+  klog_flush();
   puts("system error!\n");
+  kzmem_dumpstat(); // 動的メモリの獲得失敗が原因なら、そのプールを表示する
   while (1) // 無限ループに入り停止する。
     ;
 }
@@ -5,6 +5,62 @@
 #include "interrupt.h"
 #include "syscall.h"
 
+////////////////////////////////////////
+// スレッドとメッセージボックスの静的な定義
+////////////////////////////////////////
+
+// メッセージ・ボックス(中身はカーネルだけが操作する)
+typedef struct _kz_msgbox {
+  struct _kz_thread *receiver;
+  struct _kz_msgbuf *head;
+  struct _kz_msgbuf *tail;
+
+  /* 構造体のサイズが2の累乗になるように調整 */
+  long dummy[1];
+} kz_msgbox_t;
+
+// メッセージボックスを定義する(.bssの.kzmsgbox部分に置かれ、起動時に0で初期化される)
+#define KZ_MSGBOX_DEFINE(name) \
+  kz_msgbox_t kz_msgbox_##name __attribute__((section(".bss.kzmsgbox")))
+#define KZ_MSGBOX_DEFINE_ARRAY(name, num) \
+  kz_msgbox_t kz_msgbox_##name[num] __attribute__((section(".bss.kzmsgbox")))
+#define KZ_MSGBOX_DECLARE(name) extern kz_msgbox_t kz_msgbox_##name
+#define KZ_MSGBOX_DECLARE_ARRAY(name) extern kz_msgbox_t kz_msgbox_##name[]
+#define KZ_MSGBOX_ID(name) (&kz_msgbox_##name)
+
+// 起動時に生成するスレッドの定義(.kzthreadセクションに並び、kz_start()が順に起動する)
+typedef struct {
+  kz_func_t func;
+  char *name;
+  int priority;
+  int stacksize;
+  char *stack; // スタック領域の末尾
+} kz_thread_def_t;
+
+// スレッドを定義する。スタックは.bssの.kzstack部分に静的に確保するので、
+// 使用量はリンク時に決まる(リンカ・スクリプトの_kzstack_start〜_kzstack_end)。
+// スタックサイズは4の倍数にすること
+#define KZ_THREAD_DEFINE(name, func, priority, stacksize) \
+  static char kz_stack_##name[stacksize] \
+    __attribute__((section(".bss.kzstack"), aligned(4))); \
+  static const kz_thread_def_t kz_thread_##name \
+    __attribute__((section(".kzthread"), used)) = \
+    { func, #name, priority, stacksize, kz_stack_##name + (stacksize) }
+
+// システムのメッセージボックス
+KZ_MSGBOX_DECLARE_ARRAY(consinput); // コンソールからの入力(デバイスごと, consdrv.c)
+KZ_MSGBOX_DECLARE(consoutput); // コンソールへの出力(consdrv.c)
+KZ_MSGBOX_DECLARE(datainput); // バイナリ転送の受信フレーム(datadrv.c)
+KZ_MSGBOX_DECLARE(dataoutput); // バイナリ転送ドライバへの要求(datadrv.c)
+KZ_MSGBOX_DECLARE(datasent); // バイナリ転送の送信完了(datadrv.c)
+
+// コンソール・デバイスnの入力用メッセージボックス
+#define MSGBOX_ID_CONSINPUT(n) (&kz_msgbox_consinput[n])
+#define MSGBOX_ID_CONSOUTPUT KZ_MSGBOX_ID(consoutput)
+#define MSGBOX_ID_DATAINPUT  KZ_MSGBOX_ID(datainput)
+#define MSGBOX_ID_DATAOUTPUT KZ_MSGBOX_ID(dataoutput)
+#define MSGBOX_ID_DATASENT   KZ_MSGBOX_ID(datasent)
+
 ////////////////////////////////////////
 // システムコール
 ////////////////////////////////////////
@@ -23,15 +79,29 @@ int kz_kmfree(void *p);
 int kz_send(kz_msgbox_id_t id, int size, char *p);
 kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **p);
 int kz_setintr(softvec_type_t type, kz_handler_t handler);
+// 呼び出し元が用意した領域に固定長メモリプールを作成
+kz_pool_id_t kz_pool_create(char *buf, int bufsize, int blksize);
+void *kz_pool_get(kz_pool_id_t id, int wait); // waitが真なら空きが出るまで待つ
+int kz_pool_put(kz_pool_id_t id, void *p);
+// 動的メモリとスレッドの統計情報の取得(indexが範囲外なら-1を返す)
+int kz_memstat(int index, kz_memstat_t *stat);
+int kz_thstat(int index, kz_thstat_t *stat);
+
+// メモリプールの管理領域のサイズ(kz_pool_create()に渡す領域はこの分を加えて確保する)
+#define KZ_POOL_HEADER_SIZE 20
+#define KZ_POOL_BUFFER_SIZE(blksize, num) \
+  (KZ_POOL_HEADER_SIZE + (((blksize) + 3) & ~3) * (num) + 3)
 
 ////////////////////////////////////////
 // サービスコール
 ////////////////////////////////////////
 
 int kx_wakeup(kz_thread_id_t id);
-void *kx_kmallc(int size);
+void *kx_kmalloc(int size);
 int kx_kmfree(void *p);
 int kx_send(kz_msgbox_id_t id, int size, char *p);
+void *kx_pool_get(kz_pool_id_t id); // 割込み処理からは待たずに戻る
+int kx_pool_put(kz_pool_id_t id, void *p);
 
 ////////////////////////////////////////
 // ライブラリ関数
@@ -41,6 +111,9 @@ int kx_send(kz_msgbox_id_t id, int size, char *p);
 void kz_start(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[]);
 // 致命的エラーの発生時に呼び出す
 void kz_sysdown(void);
+// kz_printf()の出力先(スレッドごと)
+void kz_setwriter(void *writer);
+void *kz_getwriter(void);
 // システムコールの実行
 void kz_syscall(kz_syscall_type_t type, kz_syscall_param_t *param);
 // サービスコールの呼び出し用共通関数
@@ -51,6 +124,7 @@ void kz_srvcall(kz_syscall_type_t type, kz_syscall_param_t *param);
 ////////////////////////////////////////
 
 int consdrv_main(int argc, char *argv[]); // コンソールドライバスレッド
+int datadrv_main(int argc, char *argv[]); // バイナリ転送ドライバスレッド
 
 ////////////////////////////////////////
 // ユーザータスク
@@ -68,5 +142,6 @@ int command_main(int argc, char *argv[]); // コマンドスレッド
 /* int test10_1_main(int argc, char *argv[]); */
 /* int test11_1_main(int argc, char *argv[]); */
 /* int test11_2_main(int argc, char *argv[]); */
+/* int test12_1_main(int argc, char *argv[]); */
 
 #endif
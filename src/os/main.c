@@ -2,6 +2,8 @@
 #include "interrupt.h"
 #include "kozos.h"
 #include "lib.h"
+#include "intr.h"
+#include "timer.h"
 
 /* kz_thread_id_t test09_1_id; */
 /* kz_thread_id_t test09_2_id; */
@@ -15,8 +17,12 @@ static int start_threads(int argc, char *argv[]) {
   /* kz_run(test10_1_main, "test10_1", 1, 0x100, 0, NULL); */
   /* kz_run(test11_1_main, "test11_1", 1, 0x100, 0, NULL); */
   /* kz_run(test11_2_main, "test11_2", 1, 0x100, 0, NULL); */
-  kz_run(consdrv_main, "consdrv", 1, 0x200, 0, NULL);
-  kz_run(command_main, "command", 8, 0x200, 0, NULL);
+  /* kz_run(test12_1_main, "test12_1", 2, 0x200, 0, NULL); */
+  // consdrv, datadrv, commandはKZ_THREAD_DEFINE()で定義してあり、kz_start()が起動済み
+
+  // 周期タイマの起動
+  kz_setintr(SOFTVEC_TYPE_TIMINTR, timer_intr);
+  timer_init();
 
   kz_chpri(15);
   INTR_ENABLE;
@@ -27,8 +33,17 @@ static int start_threads(int argc, char *argv[]) {
 }
 
 int main(void) {
+  // 以下はリンカ・スクリプトで定義してあるシンボル。
+  extern int data_load, data_start, edata, bss_start, ebss;
+
   INTR_DISABLE; // 割込みを無効にしてから初期化を行う
-  
+
+  // ROMで実行する場合(ld_rom.scr)は、データ領域の初期値をROMからコピーする。
+  // kzloadでロードした場合はロード時に配置済みなので、コピーは不要。
+  if (&data_load != &data_start)
+    memcpy(&data_start, &data_load, (long)&edata - (long)&data_start);
+  memset(&bss_start, 0, (long)&ebss - (long)&bss_start);
+
   puts("kozos boot succeed!\n");
 
   // OSの動作開始
@@ -7,28 +7,42 @@
 typedef struct _kzmem_block {
   struct _kzmem_block *next;
   int size;
+  kz_thread_id_t owner;         /* 獲得したスレッド(カーネル・割込みなら0) */
 } kzmem_block;
 
 /* メモリプール */
 typedef struct _kzmem_pool {
   int size;
+  int ratio;                    /* ヒープ全体に占める割合(%) */
   int num;
   kzmem_block *free;
+  struct {                      /* 統計情報 */
+    int count;
+    int peak;
+    int fail;
+    int spill;
+  } stat;
 } kzmem_pool;
 
-/* メモリプールの定義 */
+/*
+ * メモリプールの定義
+ * ブロック数は固定値ではなく、リンカ・スクリプトで定義されるヒープ領域
+ * (freearea〜heap_end)の実サイズをratioの割合で分配して決める。
+ */
 static kzmem_pool pool[] = {
-  { 16, 8, NULL }, { 32, 8, NULL }, { 64, 4, NULL},
+  { 16, 15 }, { 32, 25 }, { 64, 25 }, { 128, 20 }, { 256, 15 },
 };
 
 #define MEMORY_AREA_NUM (sizeof(pool) / sizeof(*pool))
 
-static int kzmem_init_pool(kzmem_pool *p) {
+static char *kzmem_init_pool(kzmem_pool *p, char *area, long heapsize) {
   int i;
   kzmem_block *mp;
   kzmem_block **mpp;
-  extern char freearea;
-  static char *area = &freearea;
+
+  p->num = heapsize * p->ratio / 100 / p->size;
+  if (p->num < 1) /* 最低1ブロックは用意する */
+    p->num = 1;
 
   mp = (kzmem_block *)area;
 
@@ -42,42 +56,72 @@ static int kzmem_init_pool(kzmem_pool *p) {
     area += p->size;
   }
 
-  return 0;
+  return area;
 }
 
 int kzmem_init(void) {
   int i;
+  long heapsize;
+  char *area;
+  extern char freearea, heap_end; /* リンカ・スクリプトで定義されるヒープ領域 */
+
+  area = &freearea;
+  heapsize = &heap_end - &freearea;
+
   for (i = 0; i < MEMORY_AREA_NUM; i++) {
-    kzmem_init_pool(&pool[i]);
+    area = kzmem_init_pool(&pool[i], area, heapsize);
   }
+
+  /* 割合の合計が100%を超える設定の場合はユーザー・スタックと衝突する */
+  if (area > &heap_end)
+    kz_sysdown();
+
   return 0;
 }
 
-void *kzmem_alloc(int size) {
-  int i;
+void *kzmem_alloc(int size, kz_thread_id_t owner) {
+  int i, j;
   kzmem_block *mp;
   kzmem_pool *p;
   for (i = 0; i < MEMORY_AREA_NUM; i++) {
-    p = &pool[i];
-    if (size <= p->size - sizeof(kzmem_block)) {
-      if (p->free == NULL) {    /* 解放済み領域が無い */
-        kz_sysdown();
-        return NULL;
-      }
-
-      mp = p->free;
-      p->free = p->free->next;
-      mp->next = NULL;
-      /* 実際に利用可能な領域は、メモリブロック構造体の直後の領域 */
-      return mp + 1;
-    }
+    if (size <= pool[i].size - sizeof(kzmem_block))
+      break;
   }
-  /* 指定されたサイズの領域を格納できるメモリ・プールがない。 */
-  kz_sysdown();
-  return NULL;
+  if (i == MEMORY_AREA_NUM) {
+    /* 指定されたサイズの領域を格納できるメモリ・プールがない。 */
+    pool[MEMORY_AREA_NUM - 1].stat.fail++;
+    kz_sysdown();
+    return NULL;
+  }
+
+  /* 空きが無い場合は、より大きなサイズのプールから獲得する */
+  for (j = i; j < MEMORY_AREA_NUM; j++) {
+    p = &pool[j];
+    if (p->free)
+      break;
+  }
+  if (j == MEMORY_AREA_NUM) {   /* 解放済み領域が無い */
+    pool[i].stat.fail++;
+    kz_sysdown();
+    return NULL;
+  }
+  if (j != i)
+    pool[i].stat.spill++;
+
+  mp = p->free;
+  p->free = p->free->next;
+  mp->next = NULL;
+  mp->owner = owner;
+
+  p->stat.count++;
+  if (p->stat.count > p->stat.peak)
+    p->stat.peak = p->stat.count;
+
+  /* 実際に利用可能な領域は、メモリブロック構造体の直後の領域 */
+  return mp + 1;
 }
 
-void kzmem_free(void *mem) {
+kz_thread_id_t kzmem_free(void *mem) {
   int i;
   kzmem_block *mp;
   kzmem_pool *p;
@@ -89,9 +133,50 @@ void kzmem_free(void *mem) {
     if (mp->size == p->size) {
       mp->next = p->free;
       p->free = mp;
-      return;
+      p->stat.count--;
+      return mp->owner;
     }
   }
 
   kz_sysdown();
+  return 0;
+}
+
+int kzmem_getstat(int index, kz_memstat_t *stat) {
+  kzmem_pool *p;
+
+  if (index < 0 || index >= MEMORY_AREA_NUM)
+    return -1;
+
+  p = &pool[index];
+  stat->size  = p->size;
+  stat->num   = p->num;
+  stat->count = p->stat.count;
+  stat->peak  = p->stat.peak;
+  stat->fail  = p->stat.fail;
+  stat->spill = p->stat.spill;
+
+  return 0;
+}
+
+/*
+ * 獲得に失敗したプールを直接シリアルに出力する(システムダウン時にkz_sysdown()から呼ぶ)。
+ * 獲得の失敗はそのままシステムダウンになり、memコマンドでは見られないので、
+ * ここでpool[]の配分を見直すための手がかりを残す。
+ */
+void kzmem_dumpstat(void) {
+  int i;
+  char buf[11];
+
+  for (i = 0; i < MEMORY_AREA_NUM; i++) {
+    if (!pool[i].stat.fail)
+      continue;
+    puts("kzmem: size ");
+    puts(dvaltostr(buf, pool[i].size, 0));
+    puts(" num ");
+    puts(dvaltostr(buf, pool[i].num, 0));
+    puts(" fail ");
+    puts(dvaltostr(buf, pool[i].stat.fail, 0));
+    puts("\n");
+  }
 }
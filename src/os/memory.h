@@ -2,7 +2,9 @@
 #define _KOZOS_MEMORY_H_INCLUDED_
 
 int kzmem_init(void);           /* 動的メモリの初期化 */
-void *kzmem_alloc(int size);    /* 動的メモリの獲得 */
-void kzmem_free(void *mem);     /* メモリの開放 */
+void *kzmem_alloc(int size, kz_thread_id_t owner); /* 動的メモリの獲得 */
+kz_thread_id_t kzmem_free(void *mem); /* メモリの開放(獲得したスレッドを返す) */
+int kzmem_getstat(int index, kz_memstat_t *stat); /* 統計情報の取得 */
+void kzmem_dumpstat(void); /* 獲得に失敗したプールを直接出力 */
 
 #endif
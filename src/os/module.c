@@ -0,0 +1,360 @@
+#include "defines.h"
+#include "kozos.h"
+#include "consdrv.h"
+#include "lib.h"
+#include "klog.h"
+#include "writer.h"
+#include "module.h"
+
+// 動的メモリ(kz_kmalloc())のブロックは最大256バイトでモジュールが収まらないので、
+// モジュール専用の領域から割り当てる
+#define MODULE_AREA_SIZE 0x400
+#define MODULE_NUM 4 // 同時にロードしておけるモジュールの数
+
+#define MODULE_HEADER_SIZE 32
+#define MODULE_IMPORT_NAME_SIZE 16 // インポートする関数名の最大長(NULを含む)
+#define MODULE_IDLE_MSEC 100 // パケットの途中でこれだけ受信が途切れたら中断する
+// スタックの最小値。thread_setup()が積む初期フレーム(36バイト)と、
+// 割込みでのレジスタの退避(32バイト)に、関数呼び出しの分の余裕を加える
+#define MODULE_STACK_MIN 0x80
+
+// 受信の状態
+#define MODULE_STATE_HEADER 0
+#define MODULE_STATE_IMAGE  1
+#define MODULE_STATE_RELOC  2
+#define MODULE_STATE_IMPORT 3 // インポートする位置
+#define MODULE_STATE_NAME   4 // インポートする関数名
+#define MODULE_STATE_CRC    5
+
+// モジュールから呼び出せるカーネルの関数。
+// モジュールの領域はメイン・スレッドが終了したら再利用するので、
+// 領域内のコードを実行するスレッドを増やせないようにkz_run()は公開しない。
+static const struct {
+  char *name;
+  void *func;
+} exports[] = {
+  { "kz_exit", kz_exit },
+  { "kz_wait", kz_wait },
+  { "kz_sleep", kz_sleep },
+  { "kz_wakeup", kz_wakeup },
+  { "kz_getid", kz_getid },
+  { "kz_chpri", kz_chpri },
+  { "kz_kmalloc", kz_kmalloc },
+  { "kz_kmfree", kz_kmfree },
+  { "kz_send", kz_send },
+  { "kz_recv", kz_recv },
+  { "kz_pool_create", kz_pool_create },
+  { "kz_pool_get", kz_pool_get },
+  { "kz_pool_put", kz_pool_put },
+  { "kz_memstat", kz_memstat },
+  { "kz_thstat", kz_thstat },
+  { "kz_writer_init", kz_writer_init },
+  { "kz_write", kz_write },
+  { "kz_trywrite", kz_trywrite },
+  { "kz_puts", kz_puts },
+  { "kz_printf", kz_printf },
+  { "kz_flush", kz_flush },
+};
+
+#define MODULE_EXPORT_NUM (sizeof(exports) / sizeof(*exports))
+
+// モジュールのコードはここで実行され、kzmod.ldは.dataと.bssを0起点で4バイト境界に
+// 配置するので、領域の先頭も4バイト境界にそろえる
+static char modarea[MODULE_AREA_SIZE] __attribute__((aligned(4)));
+
+// ロード済みのモジュール(スレッドが終了していれば領域を再利用する)
+static struct {
+  kz_thread_id_t id;
+  char *mem;
+  int size;
+} modules[MODULE_NUM];
+
+// 受信中のモジュール
+static struct {
+  int state;
+  int pos; // 現在の部分の中での位置
+  int count; // 残りの再配置またはインポートの数
+  unsigned char header[MODULE_HEADER_SIZE];
+  int slot; // 割り当てたmodules[]の番号
+  char *mem;
+  uint16 offset; // 再配置またはインポートする位置
+  char name[MODULE_IMPORT_NAME_SIZE];
+  uint16 crc; // 受信したデータのCRC
+  uint16 check; // 送られてきたCRC
+  char *error;
+} loader;
+
+#define HEADER16(i) (((uint16)loader.header[i] << 8) | loader.header[(i) + 1])
+#define MODULE_IMAGE_SIZE  HEADER16(4)
+#define MODULE_MEMORY_SIZE HEADER16(6)
+#define MODULE_ENTRY       HEADER16(8)
+#define MODULE_STACK_SIZE  HEADER16(10)
+#define MODULE_RELOC_NUM   HEADER16(12)
+#define MODULE_IMPORT_NUM  HEADER16(14)
+#define MODULE_PRIORITY    (loader.header[16])
+#define MODULE_NAME        ((char *)loader.header + 18)
+
+// スレッドが終了したモジュールの領域を解放する
+// (モジュールはkz_run()を呼べないので、メイン・スレッドの他に領域内で動くスレッドは無い)
+static void module_reclaim(void) {
+  int i, j;
+  kz_thstat_t stat;
+
+  for (i = 0; i < MODULE_NUM; i++) {
+    if (!modules[i].mem)
+      continue;
+    for (j = 0; kz_thstat(j, &stat) == 0; j++) {
+      if (stat.id == modules[i].id)
+        break;
+    }
+    if (stat.id != modules[i].id)
+      modules[i].mem = NULL;
+  }
+}
+
+// 他のモジュールと重ならない位置を探して割り当てる(空きが無ければ-1)
+static int module_alloc(int size) {
+  int i, slot = -1;
+  char *p = modarea;
+
+  for (i = 0; i < MODULE_NUM; i++) {
+    if (!modules[i].mem)
+      slot = i;
+  }
+  if (slot < 0)
+    return -1;
+
+  size = (size + 3) & ~3;
+  for (i = 0; i < MODULE_NUM; i++) {
+    if (!modules[i].mem)
+      continue;
+    if ((p < modules[i].mem + modules[i].size) && (modules[i].mem < p + size)) {
+      p = modules[i].mem + modules[i].size; // 重なったら、その後ろから探し直す
+      i = -1;
+    }
+  }
+  if (p + size > modarea + MODULE_AREA_SIZE)
+    return -1;
+  if ((uint32)p & 3) // 奇数アドレスでは命令フェッチもワード・アクセスもできない
+    kz_sysdown();
+
+  modules[slot].id = 0;
+  modules[slot].mem = p;
+  modules[slot].size = size;
+  return slot;
+}
+
+// 24ビットの領域に値を加える
+static void module_add24(char *p, uint32 value) {
+  value += ((uint32)(uint8)p[0] << 16) | ((uint32)(uint8)p[1] << 8) | (uint8)p[2];
+  p[0] = (value >> 16) & 0xff;
+  p[1] = (value >> 8) & 0xff;
+  p[2] = value & 0xff;
+}
+
+static int module_error(char *error) {
+  loader.error = error;
+  return -1;
+}
+
+static int module_check_header(void) {
+  if (memcmp(loader.header, "KZM1", 4))
+    return module_error("bad header");
+  if ((MODULE_IMAGE_SIZE == 0) || (MODULE_IMAGE_SIZE > MODULE_MEMORY_SIZE) ||
+      (MODULE_ENTRY >= MODULE_IMAGE_SIZE))
+    return module_error("bad size");
+  if ((MODULE_PRIORITY == 0) || (MODULE_PRIORITY >= 16)) // 0は割込み禁止スレッドになる
+    return module_error("bad priority");
+  if ((MODULE_STACK_SIZE < MODULE_STACK_MIN) || (MODULE_STACK_SIZE & 3))
+    return module_error("bad stack size");
+  loader.header[MODULE_HEADER_SIZE - 1] = '\0'; // スレッド名を終端しておく
+
+  loader.slot = module_alloc(MODULE_MEMORY_SIZE);
+  if (loader.slot < 0)
+    return module_error("no memory");
+  loader.mem = modules[loader.slot].mem;
+  return 0;
+}
+
+// 次の部分に進む
+static void module_next(void) {
+  loader.pos = 0;
+  if (loader.state < MODULE_STATE_RELOC) {
+    loader.state = MODULE_STATE_RELOC;
+    loader.count = MODULE_RELOC_NUM;
+  }
+  if ((loader.state == MODULE_STATE_RELOC) && (loader.count == 0)) {
+    loader.state = MODULE_STATE_IMPORT;
+    loader.count = MODULE_IMPORT_NUM;
+  }
+  if ((loader.state == MODULE_STATE_IMPORT) && (loader.count == 0))
+    loader.state = MODULE_STATE_CRC;
+}
+
+static int module_import(void) {
+  int i;
+
+  for (i = 0; i < MODULE_EXPORT_NUM; i++) {
+    if (!strcmp(loader.name, exports[i].name)) {
+      module_add24(loader.mem + loader.offset, (uint32)exports[i].func);
+      return 0;
+    }
+  }
+  return module_error("unresolved symbol");
+}
+
+// 受信した1バイトを処理する。完了なら1、エラーなら-1を返す
+static int module_byte(unsigned char c) {
+  if (loader.state != MODULE_STATE_CRC)
+    loader.crc = crc16_byte(loader.crc, c);
+
+  switch (loader.state) {
+  case MODULE_STATE_HEADER:
+    loader.header[loader.pos++] = c;
+    if (loader.pos == MODULE_HEADER_SIZE) {
+      if (module_check_header() < 0)
+        return -1;
+      loader.state = MODULE_STATE_IMAGE;
+      loader.pos = 0;
+    }
+    break;
+
+  case MODULE_STATE_IMAGE:
+    loader.mem[loader.pos++] = c;
+    if (loader.pos == MODULE_IMAGE_SIZE) {
+      memset(loader.mem + MODULE_IMAGE_SIZE, 0, // BSS領域を0で初期化
+             MODULE_MEMORY_SIZE - MODULE_IMAGE_SIZE);
+      module_next();
+    }
+    break;
+
+  case MODULE_STATE_RELOC:
+  case MODULE_STATE_IMPORT:
+    loader.offset = (loader.offset << 8) | c;
+    if (++loader.pos < 2)
+      break;
+    if (loader.offset + 3 > MODULE_IMAGE_SIZE)
+      return module_error("bad relocation");
+    if (loader.state == MODULE_STATE_IMPORT) {
+      loader.state = MODULE_STATE_NAME;
+      loader.pos = 0;
+      break;
+    }
+    // リンク時のアドレスは0起点なので、ロード先のアドレスを加える
+    module_add24(loader.mem + loader.offset, (uint32)loader.mem);
+    loader.count--;
+    module_next();
+    break;
+
+  case MODULE_STATE_NAME:
+    loader.name[loader.pos++] = c;
+    if (c) {
+      if (loader.pos == MODULE_IMPORT_NAME_SIZE)
+        return module_error("bad import");
+      break;
+    }
+    if (module_import() < 0)
+      return -1;
+    loader.state = MODULE_STATE_IMPORT;
+    loader.count--;
+    module_next();
+    break;
+
+  case MODULE_STATE_CRC:
+    loader.check = (loader.check << 8) | c;
+    if (++loader.pos < 2)
+      break;
+    // CRCはその直前までのデータのCRCと一致する
+    if (loader.check != loader.crc)
+      return module_error("crc error");
+    return 1;
+
+  default:
+    return module_error("bad state");
+  }
+
+  return 0;
+}
+
+static void send_mode(int device, int mode, int chunk, int idle) {
+  char *p;
+  p = kz_kmalloc(5);
+  p[0] = '0' + device;
+  p[1] = CONSDRV_CMD_MODE;
+  p[2] = mode;
+  p[3] = chunk;
+  p[4] = idle;
+  kz_send(MSGBOX_ID_CONSOUTPUT, 5, p);
+}
+
+static void module_reply(char c) {
+  kz_write(&c, 1);
+  kz_flush();
+}
+
+kz_thread_id_t module_load(int device) {
+  char *p;
+  int i, size, r = 0;
+  long total = 0;
+  kz_thread_id_t id = 0;
+
+  module_reclaim();
+  memset(&loader, 0, sizeof(loader));
+  loader.slot = -1;
+
+  // 受信を始められることを、RAWモードに切り替えてから知らせる
+  send_mode(device, CONSDRV_MODE_RAW, MODULE_PACKET_SIZE, MODULE_IDLE_MSEC);
+  module_reply(MODULE_ACK);
+
+  // ホストは最後のパケットも詰め物をしてMODULE_PACKET_SIZEにそろえて送る。
+  // パケットの途中で途切れた場合(手入力など)は中断する。
+  while (1) {
+    kz_recv(MSGBOX_ID_CONSINPUT(device), &size, &p);
+    for (i = 0; (i < size) && !r; i++)
+      r = module_byte(p[i]);
+    total += size;
+    consdrv_release(p);
+    if (total % MODULE_PACKET_SIZE) {
+      if (!r)
+        r = module_error("transfer interrupted");
+      break;
+    }
+    if (r)
+      break;
+    module_reply(MODULE_ACK);
+  }
+
+  if (r > 0) {
+    id = kz_run((kz_func_t)(loader.mem + MODULE_ENTRY), MODULE_NAME,
+                MODULE_PRIORITY, MODULE_STACK_SIZE, 0, NULL);
+    if (id == (kz_thread_id_t)-1) {
+      id = 0;
+      r = module_error("cannot run thread");
+    }
+  }
+
+  module_reply((r > 0) ? MODULE_ACK : MODULE_NAK);
+  send_mode(device, CONSDRV_MODE_LINE, 0, 0);
+
+  if (r < 0) {
+    if (loader.slot >= 0)
+      modules[loader.slot].mem = NULL;
+    kz_printf("load error: %s", loader.error);
+    if (loader.state == MODULE_STATE_NAME)
+      kz_printf(" %s", loader.name);
+    kz_printf("\n");
+    return 0;
+  }
+
+  // 終了したスレッドのTCBが再利用された場合、同じIDの古いモジュールはもう動いていない
+  for (i = 0; i < MODULE_NUM; i++) {
+    if (modules[i].mem && (modules[i].id == id))
+      modules[i].mem = NULL;
+  }
+  modules[loader.slot].id = id;
+  KZ_LOG3("module: id=%08lx at %08lx, size %d", id, loader.mem,
+          MODULE_MEMORY_SIZE);
+  kz_printf("%s: loaded at %lx (%u bytes)\n", MODULE_NAME,
+            (uint32)loader.mem, MODULE_MEMORY_SIZE);
+  return id;
+}
@@ -0,0 +1,38 @@
+#ifndef _MODULE_H_INCLUDED_
+#define _MODULE_H_INCLUDED_
+
+// アプリケーション・モジュールの動的ロード。
+// モジュールはtools/kzmod.pyで作成する。ファイルの形式は以下のとおり(ビッグエンディアン)。
+//
+//   ヘッダ(32バイト)
+//     magic[4]       "KZM1"
+//     image_size(2)  ロードするイメージのサイズ(.text, .rodata, .data)
+//     memory_size(2) BSSを含めたサイズ
+//     entry(2)       エントリポイント(スレッドのメイン関数)の位置
+//     stack_size(2)  スレッドのスタックサイズ(4の倍数で、0x80以上)
+//     reloc_num(2)   再配置の数
+//     import_num(2)  インポートの数
+//     priority(1)    スレッドの優先度
+//     reserve(1)
+//     name[14]       スレッド名(NUL終端)
+//   イメージ(image_size)
+//   再配置(2 x reloc_num)   ロード先のアドレスを加える24ビットの領域の位置
+//   インポート(import_num)  24ビットの領域の位置(2)と、関数名(NUL終端)
+//   CRC-16(2)               ここまでの全体のCRC
+//
+// モジュールはカーネルの関数をインポートして呼び出せるが、kz_run()は使えない。
+// モジュールの領域はメイン・スレッドが終了したところで再利用するので、
+// 他のスレッドが領域内のコードを実行し続けることがないようにしている。
+//
+// 転送はコンソールのRAWモードで行う。ホストはMODULE_PACKET_SIZEごとに
+// MODULE_ACKを待ちながら送り、エラーならMODULE_NAKが返って中断する。
+
+#define MODULE_PACKET_SIZE 32
+#define MODULE_ACK 0x06
+#define MODULE_NAK 0x15
+
+// モジュールを受信して起動する(コマンド処理スレッドから呼ぶ)。
+// deviceはコンソール・デバイスの番号。起動したスレッドのIDを返す(失敗なら0)
+kz_thread_id_t module_load(int device);
+
+#endif
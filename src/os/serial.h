@@ -1,11 +1,33 @@
 #ifndef _SERIAL_H_INCLUDED_
 #define _SERIAL_H_INCLUDED_
 
+#define SERIAL_SCI_NUM 3 // SCIのチャネル数
+#define SERIAL_DEFAULT_BAUD 9600
+
+// 通信フォーマット(serial_config()のformatに指定する)
+#define SERIAL_FORMAT_8N1 0 // データ8ビット、パリティなし、ストップ1ビット
+#define SERIAL_FORMAT_DATA7 (1<<0) // データ7ビット
+#define SERIAL_FORMAT_PARITY_EVEN (1<<1) // 偶数パリティ
+#define SERIAL_FORMAT_PARITY_ODD (1<<2) // 奇数パリティ
+#define SERIAL_FORMAT_STOP2 (1<<3) // ストップ2ビット
+
+// チャネルごとの統計情報
+typedef struct {
+  uint32 recv; // 受信したバイト数
+  uint32 send; // 送信したバイト数
+  uint32 overrun; // オーバーラン・エラーの回数
+  uint32 framing; // フレーミング・エラーの回数
+  uint32 parity; // パリティ・エラーの回数
+} serial_stat_t;
+
 int serial_init(int index); // デバイス初期化
+int serial_config(int index, long baud, int format); // ボーレート等の設定
 int serial_is_send_enable(int index); // 送信可能か
 int serial_send_byte(int index, unsigned char b); // 1文字送信
 int serial_is_recv_enable(int index); // 受信可能か
 unsigned char serial_recv_byte(int index); // 1文字受信
+int serial_getstat(int index, serial_stat_t *stat); // 統計情報の取得
+long serial_char_clocks(int index); // 1文字の転送時間(φのクロック数)
 
 int serial_intr_is_send_enable(int index); // 送信割込みが有効か？
 void serial_intr_send_enable(int index); // 送信割込み有効化
@@ -96,6 +96,47 @@ int kz_setintr(softvec_type_t type, kz_handler_t handler) {
   return param.un.setintr.ret;
 }
 
+kz_pool_id_t kz_pool_create(char *buf, int bufsize, int blksize) {
+  kz_syscall_param_t param;
+  param.un.poolcre.buf = buf;
+  param.un.poolcre.bufsize = bufsize;
+  param.un.poolcre.blksize = blksize;
+  kz_syscall(KZ_SYSCALL_TYPE_POOLCRE, &param);
+  return param.un.poolcre.ret;
+}
+
+void *kz_pool_get(kz_pool_id_t id, int wait) {
+  kz_syscall_param_t param;
+  param.un.poolget.id = id;
+  param.un.poolget.wait = wait;
+  kz_syscall(KZ_SYSCALL_TYPE_POOLGET, &param);
+  return param.un.poolget.ret;
+}
+
+int kz_pool_put(kz_pool_id_t id, void *p) {
+  kz_syscall_param_t param;
+  param.un.poolput.id = id;
+  param.un.poolput.p = p;
+  kz_syscall(KZ_SYSCALL_TYPE_POOLPUT, &param);
+  return param.un.poolput.ret;
+}
+
+int kz_memstat(int index, kz_memstat_t *stat) {
+  kz_syscall_param_t param;
+  param.un.memstat.index = index;
+  param.un.memstat.stat = stat;
+  kz_syscall(KZ_SYSCALL_TYPE_MEMSTAT, &param);
+  return param.un.memstat.ret;
+}
+
+int kz_thstat(int index, kz_thstat_t *stat) {
+  kz_syscall_param_t param;
+  param.un.thstat.index = index;
+  param.un.thstat.stat = stat;
+  kz_syscall(KZ_SYSCALL_TYPE_THSTAT, &param);
+  return param.un.thstat.ret;
+}
+
 /* サービスコール */
 int kx_wakeup(kz_thread_id_t id) {
   kz_syscall_param_t param;
@@ -126,3 +167,19 @@ int kx_send(kz_msgbox_id_t id, int size, char *p) {
   kz_srvcall(KZ_SYSCALL_TYPE_SEND, &param);
   return param.un.send.ret;
 }
+
+void *kx_pool_get(kz_pool_id_t id) {
+  kz_syscall_param_t param;
+  param.un.poolget.id = id;
+  param.un.poolget.wait = 0; // 割込み処理中はスリープできない
+  kz_srvcall(KZ_SYSCALL_TYPE_POOLGET, &param);
+  return param.un.poolget.ret;
+}
+
+int kx_pool_put(kz_pool_id_t id, void *p) {
+  kz_syscall_param_t param;
+  param.un.poolput.id = id;
+  param.un.poolput.p = p;
+  kz_srvcall(KZ_SYSCALL_TYPE_POOLPUT, &param);
+  return param.un.poolput.ret;
+}
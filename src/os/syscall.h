@@ -16,9 +16,32 @@ typedef enum {
   KZ_SYSCALL_TYPE_KMFREE,
   KZ_SYSCALL_TYPE_SEND,
   KZ_SYSCALL_TYPE_RECV,
-  KZ_SYSCALL_TYPE_SETINTR
+  KZ_SYSCALL_TYPE_SETINTR,
+  KZ_SYSCALL_TYPE_POOLCRE,
+  KZ_SYSCALL_TYPE_POOLGET,
+  KZ_SYSCALL_TYPE_POOLPUT,
+  KZ_SYSCALL_TYPE_MEMSTAT,
+  KZ_SYSCALL_TYPE_THSTAT
 } kz_syscall_type_t;
 
+// 動的メモリの統計情報(メモリプール1種類分)
+typedef struct {
+  int size;     // ブロックサイズ
+  int num;      // ブロック数
+  int count;    // 使用中のブロック数
+  int peak;     // 使用中ブロック数の最大値
+  int fail;     // 獲得失敗回数
+  int spill;    // 空きが無く、上位のプールから獲得した回数
+} kz_memstat_t;
+
+// スレッドの情報
+typedef struct {
+  kz_thread_id_t id;    // 未使用のTCBならば0
+  char *name;
+  int priority;
+  int memblocks;        // 獲得して未解放の動的メモリのブロック数
+} kz_thstat_t;
+
 // システムコール呼び出し時のパラメータ格納域の定義
 typedef struct {
   union {
@@ -76,6 +99,32 @@ typedef struct {
       kz_handler_t handler;
       int ret;
     } setintr;
+    struct { // kz_pool_create()のためのパラメータ
+      char *buf;
+      int bufsize;
+      int blksize;
+      kz_pool_id_t ret;
+    } poolcre;
+    struct { // kz_pool_get()のためのパラメータ
+      kz_pool_id_t id;
+      int wait;
+      void *ret;
+    } poolget;
+    struct { // kz_pool_put()のためのパラメータ
+      kz_pool_id_t id;
+      void *p;
+      int ret;
+    } poolput;
+    struct { // kz_memstat()のためのパラメータ
+      int index;
+      kz_memstat_t *stat;
+      int ret;
+    } memstat;
+    struct { // kz_thstat()のためのパラメータ
+      int index;
+      kz_thstat_t *stat;
+      int ret;
+    } thstat;
   } un;
 } kz_syscall_param_t;
 
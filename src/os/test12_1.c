@@ -0,0 +1,69 @@
+#include "defines.h"
+#include "kozos.h"
+#include "lib.h"
+#include "datadrv.h"
+
+// バイナリ転送ドライバのループバック試験。
+// ドライバがエンコードしたフレームをそのままデコーダに折り返させ、
+// CRCを確認して受信したフレームが送信データと一致することを確かめる。
+
+#define TEST_DATA_MAX (DATADRV_FRAME_SIZE - 2) // CRCの分を除いた最大長
+
+static char data[TEST_DATA_MAX];
+
+static int test_frame(int size, int seed) {
+  static datadrv_req req;
+  char *frame, *p;
+  int i, len, ret = 0;
+
+  // 0x00(COBSで置き換わる値)と0xffを必ず含むように埋める
+  for (i = 0; i < size; i++) {
+    if (i % 5 == 0)
+      data[i] = 0;
+    else if (i % 5 == 1)
+      data[i] = 0xff;
+    else
+      data[i] = ((i * seed) & 0xff) | 1;
+  }
+
+  req.cmd  = DATADRV_CMD_SEND;
+  req.buf  = data;
+  req.size = size;
+  kz_send(MSGBOX_ID_DATAOUTPUT, sizeof(req), (char *)&req);
+
+  kz_recv(MSGBOX_ID_DATAINPUT, &len, &frame);
+  if ((len != size) || memcmp(frame, data, size))
+    ret = -1;
+  datadrv_release(frame);
+
+  kz_recv(MSGBOX_ID_DATASENT, NULL, &p); // 送信完了の通知(要求が返される)
+  if (p != (char *)&req)
+    ret = -1;
+
+  puts("size ");
+  putxval(size, 2);
+  puts(ret ? " NG\n" : " OK\n");
+  return ret;
+}
+
+int test12_1_main(int argc, char *argv[]) {
+  static datadrv_req req;
+  static const int sizes[] = { 1, 2, 5, 31, 64, TEST_DATA_MAX };
+  int i, errors = 0;
+
+  puts("test12_1 started.\n");
+
+  req.cmd   = DATADRV_CMD_USE;
+  req.index = 0; // ループバックではシリアルを使わない
+  req.flags = DATADRV_FLAG_LOOPBACK;
+  kz_send(MSGBOX_ID_DATAOUTPUT, sizeof(req), (char *)&req);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+    if (test_frame(sizes[i], i * 2 + 0x35) < 0)
+      errors++;
+  }
+
+  puts(errors ? "test12_1 failed.\n" : "test12_1 passed.\n");
+  puts("test12_1 exit.\n");
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "defines.h"
+#include "interrupt.h"
+#include "timer.h"
+
+// 16ビットタイマ(チャネル0)をコンペアマッチAで周期動作させる
+#define H8_3069F_TSTR  ((volatile uint8 *)0xffff60)
+#define H8_3069F_TISRA ((volatile uint8 *)0xffff64)
+#define H8_3069F_ITU0  ((volatile struct h8_3069f_itu *)0xffff68)
+
+struct h8_3069f_itu {
+  volatile uint8 tcr;
+  volatile uint8 tior;
+  volatile uint16 tcnt;
+  volatile uint16 gra;
+  volatile uint16 grb;
+};
+
+// TCRの各ビットの定義
+#define H8_3069F_ITU_TCR_TPSC_PER1 (0<<0)
+#define H8_3069F_ITU_TCR_TPSC_PER2 (1<<0)
+#define H8_3069F_ITU_TCR_TPSC_PER4 (2<<0)
+#define H8_3069F_ITU_TCR_TPSC_PER8 (3<<0)
+#define H8_3069F_ITU_TCR_CCLR_GRA (1<<5)
+
+// TSTR, TISRAのチャネル0のビット
+#define H8_3069F_TSTR_STR0 (1<<0)
+#define H8_3069F_TISRA_IMFA0 (1<<0)
+#define H8_3069F_TISRA_IMIEA0 (1<<4)
+
+#define TIMER_HANDLER_NUM 4
+
+static volatile uint32 ticks;
+static kz_handler_t handlers[TIMER_HANDLER_NUM];
+
+int timer_init(void) {
+  volatile struct h8_3069f_itu *itu = H8_3069F_ITU0;
+
+  ticks = 0;
+
+  *H8_3069F_TSTR &= ~H8_3069F_TSTR_STR0;
+  itu->tcr = H8_3069F_ITU_TCR_CCLR_GRA | H8_3069F_ITU_TCR_TPSC_PER8;
+  itu->tior = 0;
+  itu->tcnt = 0;
+  itu->gra = TIMER_COUNT_PER_TICK - 1;
+  *H8_3069F_TISRA = (*H8_3069F_TISRA & ~H8_3069F_TISRA_IMFA0) | H8_3069F_TISRA_IMIEA0;
+  *H8_3069F_TSTR |= H8_3069F_TSTR_STR0;
+
+  return 0;
+}
+
+void timer_intr(void) {
+  int i;
+
+  // コンペアマッチ・フラグを落とす
+  *H8_3069F_TISRA &= ~H8_3069F_TISRA_IMFA0;
+  ticks++;
+
+  for (i = 0; i < TIMER_HANDLER_NUM; i++) {
+    if (handlers[i])
+      handlers[i]();
+  }
+}
+
+uint32 timer_get_ticks(void) {
+  return ticks;
+}
+
+uint16 timer_get_count(void) {
+  return H8_3069F_ITU0->tcnt;
+}
+
+// ティックごとの処理を登録する(スレッドから呼ぶ)
+int timer_add_handler(kz_handler_t handler) {
+  int i;
+
+  INTR_DISABLE;
+  for (i = 0; i < TIMER_HANDLER_NUM; i++) {
+    if (!handlers[i]) {
+      handlers[i] = handler;
+      break;
+    }
+  }
+  INTR_ENABLE;
+
+  return (i == TIMER_HANDLER_NUM) ? -1 : 0;
+}
@@ -0,0 +1,14 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+#define TIMER_TICK_MSEC 1 // タイマ割込みの周期(ミリ秒)
+#define TIMER_CLOCK_DIV 8 // カウンタはφ/8(2.5MHz)で数える
+#define TIMER_COUNT_PER_TICK (20000000L / TIMER_CLOCK_DIV / 1000 * TIMER_TICK_MSEC)
+
+int timer_init(void); // 周期タイマの初期化と起動
+void timer_intr(void); // タイマ割込みハンドラ(SOFTVEC_TYPE_TIMINTRに登録する)
+uint32 timer_get_ticks(void); // 起動してからのティック数
+uint16 timer_get_count(void); // ティック内のカウンタの値(0〜TIMER_COUNT_PER_TICK-1)
+int timer_add_handler(kz_handler_t handler); // ティックごとに呼ぶ処理の登録
+
+#endif
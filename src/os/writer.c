@@ -0,0 +1,177 @@
+#include "defines.h"
+#include "kozos.h"
+#include "consdrv.h"
+#include "lib.h"
+#include "writer.h"
+
+// 標準ヘッダを使わないので、可変長引数はコンパイラの組込み機能を直接使う
+typedef __builtin_va_list va_list;
+#define va_start(ap, last) __builtin_va_start(ap, last)
+#define va_arg(ap, type) __builtin_va_arg(ap, type)
+#define va_end(ap) __builtin_va_end(ap)
+
+// バッファの内容と追加の領域を、ひとつの要求でコンソールドライバに送る。
+// 要求はスタック上に置き、ドライバがコピーし終えるまで眠って待つ。
+// (送信バッファが一杯なら、空きができて全てコピーされるまで待つことになる。
+//  非ブロッキングなら空きの分だけコピーされ、バッファの残りはそのまま残す)
+static int writer_send(kz_writer_t *w, char *str, int len, int flags) {
+  consdrv_writev_t req;
+  int i;
+
+  req.device = '0' + w->device;
+  req.cmd = CONSDRV_CMD_WRITEV;
+  req.flags = flags;
+  req.num = 0;
+  if (w->len) {
+    req.seg[(int)req.num].p = w->buf;
+    req.seg[(int)req.num].size = w->len;
+    req.num++;
+  }
+  if (len) {
+    req.seg[(int)req.num].p = str;
+    req.seg[(int)req.num].size = len;
+    req.num++;
+  }
+  if (!req.num)
+    return 0;
+
+  kz_send(MSGBOX_ID_CONSOUTPUT, sizeof(req), (char *)&req);
+  kz_sleep();
+
+  if (req.done < w->len) { // 送れなかった分を先頭に詰める
+    for (i = req.done; i < w->len; i++)
+      w->buf[i - req.done] = w->buf[i];
+    w->len -= req.done;
+  } else {
+    w->len = 0;
+  }
+
+  return req.done;
+}
+
+void kz_writer_init(kz_writer_t *w, int device) {
+  w->device = device;
+  w->len = 0;
+  kz_setwriter(w);
+}
+
+int kz_write(char *str, int len) {
+  kz_writer_t *w = kz_getwriter();
+  int i, newline = 0;
+
+  if (!w)
+    return -1;
+
+  // バッファに収まらない長さなら、コピーせずにそのまま送る
+  if (len > WRITER_BUFFER_SIZE - w->len) {
+    writer_send(w, str, len, 0);
+    return len;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (str[i] == '\n')
+      newline = 1;
+    w->buf[w->len++] = str[i];
+  }
+  if (newline || (w->len == WRITER_BUFFER_SIZE))
+    writer_send(w, NULL, 0, 0);
+
+  return len;
+}
+
+int kz_trywrite(char *str, int len) {
+  kz_writer_t *w = kz_getwriter();
+  int buffered, done;
+
+  if (!w)
+    return -1;
+  // バッファに溜まっている分を先にして、ひとつの要求で送る
+  buffered = w->len;
+  done = writer_send(w, str, len, CONSDRV_WRITEV_FLAG_NONBLOCK);
+  if (done <= buffered)
+    return 0; // バッファの分も送りきれなかった(残りはバッファに残る)
+  return done - buffered;
+}
+
+int kz_puts(char *str) {
+  return kz_write(str, strlen(str));
+}
+
+int kz_printf(const char *format, ...) {
+  va_list ap;
+  const char *f;
+  char buf[11], *p;
+  unsigned long value;
+  int column, zero, islong, len, total = 0;
+
+  va_start(ap, format);
+  for (f = format; *f; f++) {
+    if (*f != '%') {
+      // 次の書式指定までをまとめて書き込む
+      for (len = 0; f[len] && (f[len] != '%'); len++)
+        ;
+      total += kz_write((char *)f, len);
+      f += len - 1;
+      continue;
+    }
+
+    f++;
+    zero = (*f == '0');
+    for (column = 0; (*f >= '0') && (*f <= '9'); f++)
+      column = column * 10 + (*f - '0');
+    islong = (*f == 'l');
+    if (islong)
+      f++;
+
+    switch (*f) {
+    case 'd':
+    case 'u':
+    case 'x':
+      if (islong)
+        value = va_arg(ap, unsigned long);
+      else
+        value = (*f == 'd') ? (long)va_arg(ap, int) : va_arg(ap, unsigned int);
+      len = 0;
+      if ((*f == 'd') && ((long)value < 0)) {
+        total += kz_write("-", 1);
+        value = -(long)value;
+        len = 1;
+      }
+      p = (*f == 'x') ? xvaltostr(buf, value, zero ? column : 0)
+                      : dvaltostr(buf, value, zero ? column : 0);
+      // 0埋めしない場合は空白で桁をそろえる
+      for (len += strlen(p); !zero && (len < column); len++)
+        total += kz_write(" ", 1);
+      total += kz_write(p, strlen(p));
+      break;
+    case 'c':
+      buf[0] = va_arg(ap, int);
+      total += kz_write(buf, 1);
+      break;
+    case 's':
+      p = va_arg(ap, char *);
+      total += kz_write(p, strlen(p));
+      break;
+    case '%':
+      total += kz_write("%", 1);
+      break;
+    case '\0':
+      f--;
+      break;
+    default:
+      break;
+    }
+  }
+  va_end(ap);
+
+  return total;
+}
+
+int kz_flush(void) {
+  kz_writer_t *w = kz_getwriter();
+
+  if (!w)
+    return -1;
+  writer_send(w, NULL, 0, 0);
+  return 0;
+}
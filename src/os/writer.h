@@ -0,0 +1,25 @@
+#ifndef _WRITER_H_INCLUDED_
+#define _WRITER_H_INCLUDED_
+
+#define WRITER_BUFFER_SIZE 64
+
+// コンソール出力をまとめて送るためのバッファ(スレッドごとに用意する)。
+// 改行、バッファが一杯になったとき、kz_flush()の呼び出しでコンソールドライバに送る。
+typedef struct {
+  int device; // 出力先のコンソール・デバイス番号
+  int len; // バッファ中のデータサイズ
+  char buf[WRITER_BUFFER_SIZE];
+} kz_writer_t;
+
+// 初期化し、呼び出したスレッドのkz_printf()の出力先にする
+void kz_writer_init(kz_writer_t *w, int device);
+int kz_write(char *str, int len); // 送信バッファに空きが無ければ、空くまで待つ
+// 送信バッファの空きの分だけ出力し、strから出力できたバイト数を返す(待たない)。
+// バッファに溜まっている分を先に出力し、送りきれなかった分はバッファに残す
+int kz_trywrite(char *str, int len);
+int kz_puts(char *str);
+// 書式は %d %u %x %c %s %% と、桁数指定(0埋め可)、l修飾子に対応
+int kz_printf(const char *format, ...);
+int kz_flush(void);
+
+#endif
@@ -0,0 +1,302 @@
+#!/usr/bin/env python3
+"""kzloadにイメージを転送して起動する。
+
+  kzload.py [options] port image
+
+  -b, --baud N     転送中だけbaudコマンドで回線速度をNに切り替える
+  -i, --initial N  kzloadの起動時の回線速度(既定 9600)
+  --block128       1Kブロック(XMODEM-1K)を使わない
+  --no-run         ロードだけ行い、runを送らない
+  --wait SEC       run後にコンソール出力を表示し続ける秒数(既定 2)
+
+kzloadのプロンプトを待ってloadを送り、XMODEMでイメージを送信してからrunを送る。
+受信側がCRCモード('C')を要求すればXMODEM-CRC/1K、NAKならチェックサム方式で送る。
+転送後にホスト側と、kzloadが表示した受信側の転送速度を出力する。
+
+ボードが無くても、kzsim.pyの疑似シリアル(pty)に対して同じように試せる。
+
+  kzsim.py --link /tmp/kzsim &
+  kzload.py /tmp/kzsim kozos.lz
+"""
+
+import argparse
+import os
+import re
+import select
+import sys
+import termios
+import time
+import tty
+
+from kzlog import crc16
+
+SOH = 0x01
+STX = 0x02
+EOT = 0x04
+ACK = 0x06
+NAK = 0x15
+CAN = 0x18
+EOF = 0x1a
+CRC = ord("C")
+
+BLOCK_SIZE = 128
+BLOCK_SIZE_1K = 1024
+
+PROMPT = b"kzload> "
+START_TIMEOUT = 10.0  # 受信側からの送信要求を待つ時間(kzloadは3秒ごとに要求する)
+ACK_TIMEOUT = 5.0
+RETRY_MAX = 10
+
+# 20MHzのH8/3069Fでは、115200bpsは誤差が大きくkzloadが受け付けない
+BAUDS = {
+    9600: termios.B9600, 19200: termios.B19200, 38400: termios.B38400,
+    57600: termios.B57600, 115200: termios.B115200,
+}
+
+
+class LoadError(Exception):
+    pass
+
+
+class Port:
+    """rawモードのシリアル(端末)"""
+
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        self.set_baud(baud)
+        self.pending = bytearray()
+
+    def set_baud(self, baud):
+        if baud not in BAUDS:
+            raise LoadError("unsupported baud rate %d" % baud)
+        attr = termios.tcgetattr(self.fd)
+        attr[4] = attr[5] = BAUDS[baud]
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attr)
+
+    def write(self, data):
+        view = memoryview(bytes(data))
+        while view:
+            n = os.write(self.fd, view)
+            view = view[n:]
+
+    def drain(self):
+        try:
+            termios.tcdrain(self.fd)
+        except termios.error:
+            pass  # ptyでは失敗することがある
+
+    def read(self, timeout):
+        """受信済みの分を返す。無ければtimeout秒まで待つ(タイムアウトならb"")"""
+        if not self.pending:
+            r, _, _ = select.select([self.fd], [], [], max(timeout, 0))
+            if not r:
+                return b""
+            try:
+                self.pending += os.read(self.fd, 4096)
+            except OSError:  # 相手が閉じた
+                raise LoadError("port closed")
+        data = bytes(self.pending)
+        self.pending.clear()
+        return data
+
+    def getc(self, timeout):
+        deadline = time.monotonic() + timeout
+        while not self.pending:
+            rest = deadline - time.monotonic()
+            if rest <= 0:
+                return -1
+            self.pending += self.read(rest)
+        c = self.pending[0]
+        del self.pending[0]
+        return c
+
+    def expect(self, pattern, timeout, echo=None):
+        """patternが現れるまで読む。現れた位置までのデータを返す"""
+        data = bytearray()
+        deadline = time.monotonic() + timeout
+        while True:
+            pos = data.find(pattern)
+            if pos >= 0:
+                self.pending[:0] = data[pos + len(pattern):]
+                return bytes(data[:pos + len(pattern)])
+            rest = deadline - time.monotonic()
+            if rest <= 0:
+                raise LoadError("timeout waiting for %r" % pattern)
+            chunk = self.read(rest)
+            if echo:
+                echo.write(chunk.decode("latin-1").replace("\r", ""))
+                echo.flush()
+            data += chunk
+
+    def close(self):
+        os.close(self.fd)
+
+
+def command(port, cmd, timeout=2.0):
+    """コマンドを送り、エコーバックの改行までを読み捨てる"""
+    port.write(cmd.encode() + b"\r")
+    port.expect(cmd.encode() + b"\r\n", timeout)
+
+
+def wait_prompt(port, tries=5):
+    for _ in range(tries):
+        port.write(b"\r")
+        try:
+            port.expect(PROMPT, 1.0)
+        except LoadError:
+            continue
+        # 前に送った改行への応答が続けて届くことがあるので読み捨てる
+        while port.read(0.2):
+            pass
+        return
+    raise LoadError("kzload is not responding")
+
+
+def switch_baud(port, baud):
+    """kzloadのbaudコマンドで回線速度を切り替え、ホスト側も合わせる"""
+    command(port, "baud %d" % baud)
+    port.expect(b".\r\n", 2.0)  # "switching baud rate to 0x...."
+    # 設定できない速度なら、元の速度のままエラーが返ってくる
+    if b"unsupported" in port.read(0.3):
+        raise LoadError("kzload does not support %d bps" % baud)
+    port.drain()
+    port.set_baud(baud)
+    wait_prompt(port)
+
+
+def make_blocks(image, use_1k):
+    """送信するブロックを全て前もって組み立てておく。
+    ACKを受けたらすぐに次のブロックを1回の書き込みで送り出せるようにする"""
+    blocks = []
+    pos = 0
+    number = 1
+    while pos < len(image):
+        rest = len(image) - pos
+        # 残りが128バイト以下なら、詰め物を減らすため128バイトのブロックにする
+        size = BLOCK_SIZE_1K if use_1k and rest > BLOCK_SIZE else BLOCK_SIZE
+        data = image[pos:pos + size].ljust(size, bytes((EOF,)))
+        blocks.append((number & 0xff, size, data))
+        pos += size
+        number += 1
+    return blocks
+
+
+def frame(block, use_crc):
+    number, size, data = block
+    head = bytes((STX if size == BLOCK_SIZE_1K else SOH, number, 0xff - number))
+    if use_crc:
+        crc = crc16(data)
+        return head + data + bytes((crc >> 8, crc & 0xff))
+    return head + data + bytes((sum(data) & 0xff,))
+
+
+def xmodem_send(port, image, allow_1k, log):
+    # 受信側の送信要求を待つ('C'ならCRCモード、NAKならチェックサム方式)
+    deadline = time.monotonic() + START_TIMEOUT
+    while True:
+        c = port.getc(max(deadline - time.monotonic(), 0))
+        if c in (CRC, NAK):
+            break
+        if c < 0:
+            raise LoadError("no request from receiver")
+    use_crc = (c == CRC)
+    use_1k = use_crc and allow_1k  # 1Kブロックは CRCモードでのみ使う
+    blocks = make_blocks(image, use_1k)
+    frames = [frame(b, use_crc) for b in blocks]
+    log.write("mode: %s, %d blocks\n" % (
+        ("XMODEM-1K" if use_1k else "XMODEM-CRC") if use_crc else "XMODEM",
+        len(blocks)))
+
+    retries = 0
+    errors = 0
+    start = time.monotonic()
+    i = 0
+    while i <= len(frames):
+        last = (i == len(frames))
+        port.write(bytes((EOT,)) if last else frames[i])
+        c = port.getc(ACK_TIMEOUT)
+        # ACK/NAK/CAN以外は雑音として読み捨てる
+        while c not in (ACK, NAK, CAN, CRC, -1):
+            c = port.getc(ACK_TIMEOUT)
+        if c == ACK:
+            i += 1
+            errors = 0
+        elif c == CAN:
+            raise LoadError("canceled by receiver at block %d" % (i + 1))
+        else:  # 再送する('C'は最初のブロックを取りこぼした場合)
+            retries += 1
+            errors += 1
+            if errors >= RETRY_MAX:
+                raise LoadError("too many retries at block %d" % (i + 1))
+    elapsed = time.monotonic() - start
+    sent = sum(len(f) for f in frames)
+    return len(blocks), retries, sent, elapsed
+
+
+def load(args):
+    with open(args.image, "rb") as f:
+        image = f.read()
+    log = sys.stderr
+    port = Port(args.port, args.initial)
+    try:
+        wait_prompt(port)
+        fast = args.baud and args.baud != args.initial
+        if fast:
+            switch_baud(port, args.baud)
+
+        command(port, "load")
+        blocks, retries, sent, elapsed = xmodem_send(
+            port, image, not args.block128, log)
+        report = port.expect(PROMPT, 5.0).decode("latin-1")
+        if "succeeded" not in report:
+            raise LoadError("load failed:" + report.replace("\r", ""))
+        log.write("host:   %d bytes (%d framed, %d retries) in %d ms "
+                  "(%d bytes/s)\n" % (len(image), sent, retries,
+                                      elapsed * 1000, len(image) / elapsed))
+        m = re.search(r"(\d+) bytes in (\d+) ms \((\d+) bytes/s\)", report)
+        if m:
+            log.write("target: %s bytes in %s ms (%s bytes/s)\n" % m.groups())
+
+        # 起動したOSがどの速度で出力しても(kzloadの設定を引き継ぐか、初期化し直すか)
+        # ホストやmake runの端末と食い違わないように、起動時の速度に戻してからrunする
+        if fast:
+            switch_baud(port, args.initial)
+
+        if not args.no_run:
+            command(port, "run")
+            port.expect(b"\n", 2.0, echo=sys.stdout)
+            deadline = time.monotonic() + args.wait
+            while time.monotonic() < deadline:
+                try:
+                    data = port.read(deadline - time.monotonic())
+                except LoadError:  # 起動後に相手が閉じた場合(kzsim.py --once)
+                    break
+                sys.stdout.write(data.decode("latin-1").replace("\r", ""))
+                sys.stdout.flush()
+    finally:
+        port.close()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        usage="%(prog)s [options] port image",
+        description=__doc__.split("\n\n")[0])
+    parser.add_argument("port")
+    parser.add_argument("image")
+    parser.add_argument("-b", "--baud", type=int, default=0)
+    parser.add_argument("-i", "--initial", type=int, default=9600)
+    parser.add_argument("--block128", action="store_true")
+    parser.add_argument("--no-run", action="store_true")
+    parser.add_argument("--wait", type=float, default=2.0)
+    args = parser.parse_args(argv[1:])
+    try:
+        load(args)
+    except LoadError as e:
+        sys.stderr.write("kzload.py: %s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
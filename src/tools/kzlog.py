@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""KOZOSのバイナリ・ログ(klog_record)をホスト側で復元する。
+
+  kzlog.py dict kozos.elf > kozos.kzlog     書式文字列の辞書を作る
+  kzlog.py decode kozos.kzlog [capture]     受信したログを復元する(省略時は標準入力)
+
+ログのストリームは、テキストの間に 0x00 で前後を区切ったCOBSの記録が挟まる形になる。
+記録の中身は ID(2) タイムスタンプ(4) 引数(4 x n) + CRC-16(2) で、すべてビッグエンディアン。
+記録はシェルを邪魔しないよう既定では出力されないので、commandで"klog on"を実行しておく。
+"""
+
+import json
+import re
+import struct
+import sys
+
+SECTION = ".kzlog"
+TICK_MSEC = 1  # TIMER_TICK_MSEC
+
+
+def read_section(path, name):
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF":
+        raise SystemExit("%s: not an ELF file" % path)
+    # H8/300HはELF32ビッグエンディアン
+    shoff, = struct.unpack_from(">I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from(">HHH", elf, 0x2e)
+
+    def header(i):
+        return struct.unpack_from(">IIIIIIIIII", elf, shoff + i * shentsize)
+
+    strtab = header(shstrndx)
+    for i in range(shnum):
+        sh = header(i)
+        start = strtab[4] + sh[0]
+        end = elf.index(b"\0", start)
+        if elf[start:end].decode() == name:
+            return sh[3], elf[sh[4]:sh[4] + sh[5]]
+    raise SystemExit("%s: no %s section" % (path, name))
+
+
+def make_dict(path):
+    addr, data = read_section(path, SECTION)
+    formats = {}
+    pos = 0
+    while pos < len(data):
+        if data[pos] == 0:  # 配置の詰め物
+            pos += 1
+            continue
+        end = data.index(b"\0", pos)
+        formats[str(addr + pos)] = data[pos:end].decode("utf-8", "replace")
+        pos = end + 1
+    return formats
+
+
+def crc16(data, crc=0):
+    for c in data:
+        crc ^= c << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        code = data[pos]
+        block = data[pos + 1:pos + code]
+        if code == 0 or len(block) != code - 1:
+            return None
+        out += block
+        pos += code
+        if code < 0xff and pos < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+CONVERSION = re.compile(r"%(0?)(\d*)l?([duxc%])")
+
+
+def format_record(fmt, args):
+    args = list(args)
+
+    def convert(m):
+        zero, width, conv = m.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv == "d" and value & 0x80000000:
+            value -= 1 << 32
+        if conv == "c":
+            text = chr(value & 0xff)
+        else:
+            text = ("%" + conv).replace("%u", "%d") % value
+        return text.rjust(int(width or 0), "0" if zero else " ")
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def parse_record(frame):
+    """COBSを復元してCRCを確かめる。記録でなければNoneを返す"""
+    data = cobs_decode(frame)
+    if data is None or len(data) < 8 or (len(data) - 8) % 4:
+        return None
+    body, crc = data[:-2], struct.unpack(">H", data[-2:])[0]
+    if crc16(body) != crc:
+        return None
+    fid, ticks = struct.unpack_from(">HI", body)
+    args = struct.unpack_from(">%dI" % ((len(body) - 6) // 4), body, 6)
+    return fid, ticks, args
+
+
+def format_line(formats, record):
+    fid, ticks, args = record
+    fmt = formats.get(str(fid))
+    if fmt is None:
+        return "[%10.3f] <unknown id %d> %s" % (ticks * TICK_MSEC / 1000.0, fid,
+                                                 " ".join("%08x" % a for a in args))
+    return "[%10.3f] %s" % (ticks * TICK_MSEC / 1000.0, format_record(fmt, args))
+
+
+def decode(formats, stream, out):
+    # 0x00で分割した各部分を、記録として正しく復元できるか(CRCが合うか)で見分ける。
+    # 記録の途中から取り込んだ場合も、並び順に頼らないので後続がずれない。
+    for part in stream.split(b"\0"):
+        if not part:
+            continue
+        record = parse_record(part)
+        if record:
+            out.write(format_line(formats, record) + "\n")
+        else:
+            out.write(part.replace(b"\r", b"").decode("latin-1"))
+
+
+def main(argv):
+    if len(argv) >= 3 and argv[1] == "dict":
+        json.dump(make_dict(argv[2]), sys.stdout, indent=1, sort_keys=True)
+        sys.stdout.write("\n")
+    elif len(argv) >= 3 and argv[1] == "decode":
+        with open(argv[2]) as f:
+            formats = json.load(f)
+        if len(argv) >= 4:
+            with open(argv[3], "rb") as f:
+                stream = f.read()
+        else:
+            stream = sys.stdin.buffer.read()
+        decode(formats, stream, sys.stdout)
+    else:
+        sys.stderr.write(__doc__)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+"""アプリケーション・モジュール(.kzm)を作成し、動作中のKOZOSに転送する。
+
+  kzmod.py stubs app.o > stubs.s              インポートする関数の呼び出し口を作る
+  kzmod.py pack [options] a.elf b.elf out.kzm 2つのリンク結果からモジュールを作る
+  kzmod.py send port app.kzm                  commandのloadでモジュールを送る
+
+  pack のオプション
+    -n, --name NAME     スレッド名(既定は出力ファイル名)
+    -p, --priority N    スレッドの優先度(既定 8)
+    -s, --stack N       スタックサイズ(既定 0x200)
+    -e, --entry SYM     エントリポイント(既定 _main)
+
+モジュールはロード先のアドレスが決まっていないので、同じオブジェクトを
+KZMOD_BASE=0と0x10000の2か所でリンクし、値が違う24ビットの領域を再配置の
+対象とする(src/apps/kzmod.ld)。カーネルの関数は"jmp @0:24"だけの呼び出し口を
+経由して呼び、ロード時にカーネルがジャンプ先を書き込む。形式はsrc/os/module.hを参照。
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+from kzlog import crc16
+from kzload import Port, LoadError, command, ACK, NAK
+
+MAGIC = b"KZM1"
+HEADER_SIZE = 32
+NAME_SIZE = 14
+IMPORT_NAME_SIZE = 16  # module.cのMODULE_IMPORT_NAME_SIZE
+PACKET_SIZE = 32       # module.hのMODULE_PACKET_SIZE
+STACK_MIN = 0x80       # module.cのMODULE_STACK_MIN
+BASE_A = 0
+BASE_B = 0x10000
+JMP_ABS24 = 0x5a
+
+PROMPT = b"command> "
+ACK_TIMEOUT = 2.0  # module.cはパケットの途中で100ms途切れると中断する
+
+SHT_PROGBITS = 1
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+SHN_UNDEF = 0
+STB_GLOBAL = 1
+
+
+class Elf:
+    """ELF32ビッグエンディアンのセクションとシンボル"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 2:
+            raise SystemExit("%s: not an ELF32 big-endian file" % path)
+        shoff, = struct.unpack_from(">I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(">HHH", self.data, 0x2e)
+        self.sections = [struct.unpack_from(">10I", self.data, shoff + i * shentsize)
+                         for i in range(shnum)]
+        self.shstr = self.sections[shstrndx]
+
+    def string(self, strtab, offset):
+        start = strtab[4] + offset
+        return self.data[start:self.data.index(b"\0", start)].decode()
+
+    def symbols(self):
+        """(名前, 値, 結合, セクション番号)を返す"""
+        for sh in self.sections:
+            if sh[1] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[sh[6]]
+            for pos in range(sh[4] + 16, sh[4] + sh[5], 16):  # 0番は空
+                name, value, size, info, other, shndx = \
+                    struct.unpack_from(">IIIBBH", self.data, pos)
+                yield self.string(strtab, name), value, info >> 4, shndx
+
+    def image(self, base, size):
+        """ロードする内容を、baseからsizeバイトの領域に並べる"""
+        image = bytearray(size)
+        for sh in self.sections:
+            if not (sh[2] & SHF_ALLOC) or sh[1] == SHT_NOBITS or sh[5] == 0:
+                continue
+            addr = sh[3] - base
+            if addr < 0 or addr + sh[5] > size:
+                raise SystemExit("section %s is outside the module image"
+                                 % self.string(self.shstr, sh[0]))
+            image[addr:addr + sh[5]] = self.data[sh[4]:sh[4] + sh[5]]
+        return image
+
+
+def stubs(path):
+    """未定義のシンボルごとに、ジャンプ先を後から書き込む呼び出し口を作る"""
+    names = sorted({name for name, value, bind, shndx in Elf(path).symbols()
+                    if shndx == SHN_UNDEF and bind == STB_GLOBAL and name})
+    out = ["; %s から kzmod.py stubs で生成" % os.path.basename(path),
+           "\t.h8300h", "\t.section .text", "\t.align 1"]
+    for name in names:
+        if len(name) >= IMPORT_NAME_SIZE:
+            raise SystemExit("%s: name too long to import" % name)
+        out += ["\t.global %s" % name, "%s:" % name, "\tjmp @0:24"]
+    return "\n".join(out) + "\n"
+
+
+def symbol_table(elf):
+    return {name: value for name, value, bind, shndx in elf.symbols() if name}
+
+
+def relocations(a, b):
+    """2つのイメージの差から、ロード先のアドレスを加える24ビットの領域を探す"""
+    delta = BASE_B - BASE_A
+    relocs = []
+    pos = 0
+    while pos < len(a):
+        if a[pos] == b[pos]:
+            pos += 1
+            continue
+        va = int.from_bytes(a[pos:pos + 3], "big")
+        vb = int.from_bytes(b[pos:pos + 3], "big")
+        if pos + 3 > len(a) or vb - va != delta:
+            raise SystemExit("unrelocatable reference at offset 0x%x "
+                             "(16-bit absolute address?)" % pos)
+        relocs.append(pos)
+        pos += 3
+    return relocs
+
+
+def pack(path_a, path_b, name, priority, stack, entry):
+    elf_a, elf_b = Elf(path_a), Elf(path_b)
+    sym_a, sym_b = symbol_table(elf_a), symbol_table(elf_b)
+    for sym in ("_kzmod_start", "_kzmod_image_end", "_kzmod_end", entry):
+        if sym not in sym_a:
+            raise SystemExit("%s: no symbol %s" % (path_a, sym))
+    if sym_a["_kzmod_start"] != BASE_A or sym_b["_kzmod_start"] != BASE_B:
+        raise SystemExit("modules must be linked at 0x%x and 0x%x" % (BASE_A, BASE_B))
+
+    image_size = sym_a["_kzmod_image_end"] - BASE_A
+    memory_size = sym_a["_kzmod_end"] - BASE_A
+    if memory_size > 0xffff:
+        raise SystemExit("module too large")
+    image_a = elf_a.image(BASE_A, image_size)
+    image_b = elf_b.image(BASE_B, image_size)
+    relocs = relocations(image_a, image_b)
+
+    # 呼び出し口は stubs で作った "jmp @0:24" のシンボル
+    imports = []
+    for sym, value, bind, shndx in elf_a.symbols():
+        if not sym.startswith("_") or bind != STB_GLOBAL or shndx == SHN_UNDEF:
+            continue
+        offset = value - BASE_A
+        if offset + 4 > image_size or image_a[offset] != JMP_ABS24 or \
+           image_a[offset + 1:offset + 4] != bytes(3):
+            continue  # モジュール自身で定義した関数やデータ
+        imports.append((offset + 1, sym[1:]))  # Cの名前(先頭の_を除く)
+    imports.sort()
+
+    header = bytearray(MAGIC)
+    header += struct.pack(">HHHHHHBB", image_size, memory_size,
+                          sym_a[entry] - BASE_A, stack, len(relocs),
+                          len(imports), priority, 0)
+    header += name.encode()[:NAME_SIZE - 1].ljust(NAME_SIZE, b"\0")
+    assert len(header) == HEADER_SIZE
+
+    out = header + image_a
+    for offset in relocs:
+        out += struct.pack(">H", offset)
+    for offset, sym in imports:
+        out += struct.pack(">H", offset) + sym.encode() + b"\0"
+    out += struct.pack(">H", crc16(out))
+    return bytes(out), image_size, memory_size, relocs, imports
+
+
+def wait_reply(port):
+    while True:
+        c = port.getc(ACK_TIMEOUT)
+        if c in (ACK, NAK, -1):
+            return c
+        # エラーの表示などは読み捨てる
+
+
+def send(path, port_path, baud):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != MAGIC:
+        raise LoadError("%s: not a module" % path)
+    # 最後のパケットも詰め物をしてPACKET_SIZEにそろえる(CRCの後ろは読まれない)
+    data += bytes(-len(data) % PACKET_SIZE)
+
+    port = Port(port_path, baud)
+    try:
+        # commandは"command> "を出して待つ
+        port.write(b"\r")
+        port.expect(PROMPT, 2.0)
+        while port.read(0.2):
+            pass
+        command(port, "load")
+        if wait_reply(port) != ACK:
+            raise LoadError("kernel is not ready to load")
+
+        # 最後のパケットへの応答が、起動できたかどうか(ACK/NAK)を兼ねる
+        start = time.monotonic()
+        for pos in range(0, len(data), PACKET_SIZE):
+            port.write(data[pos:pos + PACKET_SIZE])
+            c = wait_reply(port)
+            if c != ACK:
+                break
+        elapsed = time.monotonic() - start
+        if c < 0:
+            raise LoadError("no reply at offset %d" % pos)
+        report = port.expect(PROMPT, 2.0).decode("latin-1").replace("\r", "")
+        sys.stdout.write(report[:-len(PROMPT)].lstrip("\n"))
+        if c != ACK:
+            raise LoadError("load failed")
+        sys.stderr.write("%d bytes in %d ms\n" % (len(data), elapsed * 1000))
+    finally:
+        port.close()
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("stubs")
+    p.add_argument("object")
+    p = sub.add_parser("pack")
+    p.add_argument("elf_a")
+    p.add_argument("elf_b")
+    p.add_argument("output")
+    p.add_argument("-n", "--name")
+    p.add_argument("-p", "--priority", type=int, default=8)
+    p.add_argument("-s", "--stack", type=lambda s: int(s, 0), default=0x200)
+    p.add_argument("-e", "--entry", default="_main")
+    p = sub.add_parser("send")
+    p.add_argument("port")
+    p.add_argument("module")
+    p.add_argument("-b", "--baud", type=int, default=9600)
+    args = parser.parse_args(argv[1:])
+
+    if args.cmd == "stubs":
+        sys.stdout.write(stubs(args.object))
+    elif args.cmd == "pack":
+        if not 1 <= args.priority <= 15:
+            raise SystemExit("priority must be 1..15")
+        if args.stack < STACK_MIN or args.stack > 0xffff or args.stack % 4:
+            raise SystemExit("stack size must be a multiple of 4, at least 0x%x"
+                             % STACK_MIN)
+        name = args.name or os.path.splitext(os.path.basename(args.output))[0]
+        out, image_size, memory_size, relocs, imports = pack(
+            args.elf_a, args.elf_b, name, args.priority, args.stack, args.entry)
+        with open(args.output, "wb") as f:
+            f.write(out)
+        sys.stderr.write("%s: image %d bytes, memory %d bytes, "
+                         "%d relocations, %d imports (%s)\n" % (
+                             args.output, image_size, memory_size, len(relocs),
+                             len(imports), " ".join(s for o, s in imports)))
+    else:
+        try:
+            send(args.module, args.port, args.baud)
+        except LoadError as e:
+            sys.stderr.write("kzmod.py: %s\n" % e)
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
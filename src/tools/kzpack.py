@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""kozos.elfのロード可能なセグメントをLZSSで圧縮する。
+
+  kzpack.py kozos kozos.lz
+
+圧縮したセグメントはp_flagsにPF_KZ_LZSSを立て、データの先頭に展開後の
+サイズ(4バイト)を置く。圧縮しても小さくならないセグメントはそのまま格納する。
+セクション・ヘッダはロードに不要なので出力しない。
+展開はkzload(src/lib/lzss.c)が受信しながらロード先に直接行う。
+"""
+
+import struct
+import sys
+
+PT_LOAD = 1
+PF_KZ_LZSS = 0x00100000  # OS固有のフラグ(PF_MASKOSの範囲)
+
+WINDOW = 4096
+MIN_MATCH = 3
+MAX_MATCH = 18
+CHAIN = 128  # 一致を探す候補の数
+
+
+def lzss_compress(data):
+    out = bytearray(struct.pack(">I", len(data)))
+    table = {}
+    pos = 0
+    while pos < len(data):
+        flag_pos = len(out)
+        out.append(0)
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            best_len, best_off = 0, 0
+            key = data[pos:pos + MIN_MATCH]
+            if len(key) == MIN_MATCH:
+                for cand in reversed(table.get(key, [])[-CHAIN:]):
+                    if pos - cand > WINDOW:
+                        break
+                    n = MIN_MATCH
+                    limit = min(MAX_MATCH, len(data) - pos)
+                    while n < limit and data[cand + n] == data[pos + n]:
+                        n += 1
+                    if n > best_len:
+                        best_len, best_off = n, pos - cand
+                        if n == limit:
+                            break
+            if best_len >= MIN_MATCH:
+                d = best_off - 1
+                out += bytes((d & 0xff, ((d >> 8) << 4) | (best_len - MIN_MATCH)))
+                step = best_len
+            else:
+                out[flag_pos] |= 1 << bit
+                out.append(data[pos])
+                step = 1
+            for i in range(pos, pos + step):
+                table.setdefault(data[i:i + MIN_MATCH], []).append(i)
+            pos += step
+    return bytes(out)
+
+
+def lzss_decompress(comp):
+    size, = struct.unpack_from(">I", comp)
+    out = bytearray()
+    pos = 4
+    while len(out) < size:
+        flags = comp[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= size:
+                break
+            if flags & (1 << bit):
+                out.append(comp[pos])
+                pos += 1
+            else:
+                d = comp[pos] | ((comp[pos + 1] & 0xf0) << 4)
+                n = (comp[pos + 1] & 0x0f) + MIN_MATCH
+                pos += 2
+                for _ in range(n):
+                    out.append(out[-(d + 1)])
+    return bytes(out)
+
+
+def pack(elf):
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 2:
+        raise SystemExit("not an ELF32 big-endian file")
+    header = bytearray(elf[:52])
+    phoff, = struct.unpack_from(">I", header, 0x1c)
+    phentsize, phnum = struct.unpack_from(">HH", header, 0x2a)
+
+    phdrs = [list(struct.unpack_from(">8I", elf, phoff + i * phentsize))
+             for i in range(phnum)]
+
+    # ヘッダ、プログラム・ヘッダ、セグメントのデータの順に並べる
+    struct.pack_into(">I", header, 0x1c, 52)  # e_phoff
+    struct.pack_into(">I", header, 0x20, 0)   # e_shoff
+    struct.pack_into(">HHH", header, 0x2a, 32, phnum, 0)
+    struct.pack_into(">HH", header, 0x30, 0, 0)  # e_shnum, e_shstrndx
+    offset = (52 + 32 * phnum + 3) & ~3
+    body = bytearray()
+    report = []
+    for ph in phdrs:
+        ptype, poff, vaddr, paddr, filesz, memsz, flags, align = ph
+        if ptype != PT_LOAD or filesz == 0:
+            ph[1], ph[4] = 0, 0
+            continue
+        data = elf[poff:poff + filesz]
+        comp = lzss_compress(data)
+        assert lzss_decompress(comp) == data
+        if len(comp) < len(data):
+            data = comp
+            ph[6] = flags | PF_KZ_LZSS
+        ph[1] = offset + len(body)
+        ph[4] = len(data)
+        body += data
+        while len(body) & 3:
+            body.append(0)
+        report.append((paddr, filesz, len(data)))
+
+    out = bytearray(header)
+    for ph in phdrs:
+        out += struct.pack(">8I", *ph)
+    out += bytes(offset - len(out))
+    out += body
+    return bytes(out), report
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+    with open(argv[1], "rb") as f:
+        elf = f.read()
+    out, report = pack(elf)
+    with open(argv[2], "wb") as f:
+        f.write(out)
+    for paddr, orig, size in report:
+        sys.stderr.write("segment %08x: %6d -> %6d bytes\n" % (paddr, orig, size))
+    sys.stderr.write("%s: %d -> %d bytes\n" % (argv[2], len(elf), len(out)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
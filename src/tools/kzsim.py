@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+"""kzloadのシリアル・コンソールを疑似端末(pty)上で模擬する。
+
+  kzsim.py [options]
+
+  --link PATH      ptyのスレーブへのシンボリック・リンクを作る
+  --baud N         起動時の回線速度(既定 9600)。送受信ともこの速度に合わせて遅らせる
+  --no-crc         CRCモードを要求せず、チェックサム方式(NAK)で受信する
+  --error-rate R   受信したバイトを確率Rで化けさせる(再送の確認用)
+  --once           runを受け付けたら終了する
+  --reset-baud     run後、OSがSCIを初期化し直した場合のように回線速度を9600に戻す
+
+load/dump/run/baudのコマンドと、XMODEM(CRC/1K/チェックサム)の受信を
+bootload/main.cとbootload/xmodem.cに合わせて実装している。受信したイメージは
+elf.cと同じくプログラム・ヘッダを確認し、圧縮セグメント(kzpack.py)を展開して検証する。
+回線速度は1文字10ビットとして模擬するので、ボード無しで転送時間を比較できる。
+ホストがptyに設定した速度が模擬している速度と食い違うと、送受信するデータは化ける。
+"""
+
+import argparse
+import os
+import random
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+import kzpack
+from kzlog import crc16
+from kzload import SOH, STX, EOT, ACK, NAK, CAN, CRC, BAUDS
+
+# bootload/xmodem.cの定数
+XMODEM_START_MSEC = 3000
+XMODEM_START_CRC_RETRY = 3
+XMODEM_BYTE_MSEC = 1000
+XMODEM_RETRY_MAX = 10
+
+# bootload/serial.cの定数
+SERIAL_CLOCK = 20000000
+SERIAL_DEFAULT_BAUD = 9600
+SERIAL_BAUD_ERROR_MAX = 3
+
+# bootload/ld.scrのロード可能な範囲
+LOADAREA_START = 0xffbfa0
+LOADAREA_END = 0xfff720
+
+
+def serial_baud_ok(baud):
+    """serial_calc_brr()と同じく、BRRで誤差3%以内に設定できるか"""
+    for n in range(4):
+        div = (32 << (2 * n)) * baud
+        brr = (SERIAL_CLOCK + div // 2) // div - 1
+        if brr <= 255:
+            break
+    else:
+        return False
+    if brr < 0:
+        return False
+    actual = SERIAL_CLOCK // ((32 << (2 * n)) * (brr + 1))
+    return abs(actual - baud) * 100 <= baud * SERIAL_BAUD_ERROR_MAX
+
+
+class Line:
+    """回線速度に合わせて1文字ずつ送受信する"""
+
+    def __init__(self, fd, baud, error_rate):
+        self.fd = fd
+        self.error_rate = error_rate
+        self.pending = bytearray()
+        self.next_recv = 0.0  # 次の文字を受信し終える時刻
+        self.set_baud(baud)
+
+    def set_baud(self, baud):
+        self.baud = baud
+        self.char_time = 10.0 / baud  # スタート/ストップ・ビットを含めて10ビット
+
+    def mismatch(self):
+        """ホストがptyに設定した速度が、模擬している速度と違うか"""
+        try:
+            speed = termios.tcgetattr(self.fd)[5]  # マスタからはスレーブの設定が見える
+        except termios.error:
+            return False
+        return speed in BAUDS.values() and speed != BAUDS.get(self.baud)
+
+    def garble(self, data):
+        """速度が合っていなければ、相手には意味のないデータとして届く"""
+        if not self.mismatch():
+            return data
+        return bytes(random.randrange(256) for _ in data)
+
+    def send(self, data):
+        if isinstance(data, int):
+            data = bytes((data,))
+        data = self.garble(data.replace(b"\n", b"\r\n"))
+        os.write(self.fd, data)
+        time.sleep(len(data) * self.char_time)
+
+    def send_raw(self, c):
+        os.write(self.fd, self.garble(bytes((c,))))
+        time.sleep(self.char_time)
+
+    def fill(self):
+        now = time.monotonic()
+        if now > self.next_recv:
+            self.next_recv = now
+        self.pending += os.read(self.fd, 4096)
+
+    def poll(self, timeout):
+        """timeout秒以内に受信データがあるか(データは消費しない)"""
+        if not self.pending:
+            r, _, _ = select.select([self.fd], [], [], timeout)
+            if r:
+                self.fill()
+        return bool(self.pending)
+
+    def getc(self, timeout=None):
+        """1文字受信する(timeout秒で-1)。文字は回線速度の間隔でしか届かない"""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while not self.pending:
+            rest = None if deadline is None else max(deadline - time.monotonic(), 0)
+            r, _, _ = select.select([self.fd], [], [], rest)
+            if not r:
+                return -1
+            self.fill()
+        # 前の文字から1文字分の時間が経つまでは受信していないことにする
+        self.next_recv += self.char_time
+        wait = self.next_recv - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+        c = self.garble(self.pending[:1])[0]
+        del self.pending[0]
+        if self.error_rate and random.random() < self.error_rate:
+            c ^= 1 << random.randrange(8)
+        return c
+
+    def purge(self):
+        while self.getc(XMODEM_BYTE_MSEC / 1000.0) >= 0:
+            pass
+
+
+class Board:
+    def __init__(self, line, use_crc):
+        self.line = line
+        self.allow_crc = use_crc
+        self.memory = {}
+        self.entry_point = None
+        self.size = -1
+
+    def puts(self, text):
+        self.line.send(text.encode())
+
+    def gets(self):
+        buf = bytearray()
+        while True:
+            c = self.line.getc()
+            if c == ord("\r"):
+                c = ord("\n")
+            self.line.send(c)  # エコーバック
+            if c == ord("\n"):
+                return buf.decode("latin-1")
+            buf.append(c)
+
+    # xmodem.cのxmodem_wait()と同じく、'C'を3回出した後はNAKに切り替える
+    def xmodem_wait(self):
+        while True:
+            self.line.send_raw(CRC if self.use_crc else NAK)
+            if self.line.poll(XMODEM_START_MSEC / 1000.0):
+                return
+            self.start_retry += 1
+            if self.start_retry >= XMODEM_START_CRC_RETRY:
+                self.use_crc = False
+
+    def xmodem_read_block(self, size):
+        getc = lambda: self.line.getc(XMODEM_BYTE_MSEC / 1000.0)
+        number, inverse = getc(), getc()
+        if number < 0 or inverse < 0 or number ^ inverse != 0xff:
+            return -1, None
+        data = bytearray()
+        for _ in range(size):
+            c = getc()
+            if c < 0:
+                return -1, None
+            data.append(c)
+        if self.use_crc:
+            hi, lo = getc(), getc()
+            if hi < 0 or lo < 0 or (hi << 8 | lo) != crc16(data):
+                return -1, None
+        else:
+            c = getc()
+            if c < 0 or c != sum(data) & 0xff:
+                return -1, None
+        return number, bytes(data)
+
+    def xmodem_recv(self):
+        self.use_crc = self.allow_crc
+        self.start_retry = 0
+        receiving = 0
+        errors = 0
+        block_number = 1
+        data = bytearray()
+        start = 0.0
+
+        while True:
+            if not receiving:
+                self.xmodem_wait()
+            c = self.line.getc((XMODEM_START_MSEC if receiving
+                                else XMODEM_BYTE_MSEC) / 1000.0)
+            if c == EOT:
+                self.line.send_raw(ACK)
+                break
+            elif c == CAN:
+                return None, 0
+            elif c in (SOH, STX):
+                if not receiving:
+                    start = time.monotonic()
+                receiving += 1
+                r, block = self.xmodem_read_block(1024 if c == STX else 128)
+                if r == block_number:
+                    errors = 0
+                    block_number = (block_number + 1) & 0xff
+                    data += block
+                    self.line.send_raw(ACK)
+                elif r == (block_number - 1) & 0xff:
+                    self.line.send_raw(ACK)
+                elif r >= 0:
+                    self.line.send_raw(CAN)
+                    self.line.send_raw(CAN)
+                    return None, 0
+                else:
+                    errors += 1
+                    if errors >= XMODEM_RETRY_MAX:
+                        self.line.send_raw(CAN)
+                        self.line.send_raw(CAN)
+                        return None, 0
+                    self.line.purge()
+                    self.line.send_raw(NAK)
+            elif receiving:
+                errors += 1
+                if errors >= XMODEM_RETRY_MAX:
+                    self.line.send_raw(CAN)
+                    self.line.send_raw(CAN)
+                    return None, 0
+                self.line.purge()
+                self.line.send_raw(NAK)
+        return bytes(data), int((time.monotonic() - start) * 1000)
+
+    def elf_load(self, image):
+        """elf.cと同じ確認をして、ロード先のメモリの内容を作る"""
+        if image[:4] != b"\x7fELF" or image[4] != 1 or image[5] != 2:
+            return None
+        entry, phoff = struct.unpack_from(">II", image, 0x18)
+        phentsize, phnum = struct.unpack_from(">HH", image, 0x2a)
+        memory = {}
+        for i in range(phnum):
+            ptype, off, vaddr, paddr, filesz, memsz, flags, align = \
+                struct.unpack_from(">8I", image, phoff + i * phentsize)
+            if ptype != 1:
+                continue
+            if paddr < LOADAREA_START or paddr + memsz > LOADAREA_END:
+                self.puts("segment out of load area: %08x\n" % paddr)
+                return None
+            data = image[off:off + filesz]
+            if len(data) < filesz:
+                return None
+            if flags & kzpack.PF_KZ_LZSS:
+                try:
+                    data = kzpack.lzss_decompress(data)
+                except IndexError:
+                    data = None
+                if data is None or len(data) > memsz:
+                    self.puts("bad compressed segment: %08x\n" % paddr)
+                    return None
+            elif filesz > memsz:
+                return None
+            memory[paddr] = data + bytes(memsz - len(data))
+        return entry, memory
+
+    def load(self):
+        image, msec = self.xmodem_recv()
+        loaded = self.elf_load(image) if image is not None else None
+        time.sleep(0.1)  # main.cのLOAD_SETTLE_MSEC
+        if image is None:
+            self.size = -1
+            self.puts("\nXMODEM receive error!\n")
+        elif loaded is None:
+            self.size = len(image)
+            self.puts("\nELF load error!\n")
+        else:
+            self.size = len(image)
+            self.entry_point, self.memory = loaded
+            self.puts("\nXMODEM receive succeeded.\n")
+            self.puts("%d bytes in %d ms (%d bytes/s)\n" % (
+                len(image), msec, len(image) * 1000 // msec if msec else 0))
+
+    def run(self, once, reset_baud):
+        while True:
+            self.puts("kzload> ")
+            buf = self.gets()
+            if buf == "load":
+                self.load()
+            elif buf.startswith("baud "):
+                baud = int(buf[5:])
+                self.puts("switching baud rate to 0x%x.\n" % baud)
+                if serial_baud_ok(baud):
+                    self.line.set_baud(baud)
+                else:
+                    self.puts("unsupported baud rate.\n")
+            elif buf == "dump":
+                self.puts("size: %x\n" % (self.size & 0xffffffff))
+                if not self.memory:
+                    self.puts("no data.\n")
+                for addr, data in sorted(self.memory.items()):
+                    self.puts("%08x %5x\n" % (addr, len(data)))
+            elif buf == "run":
+                if self.entry_point is None:
+                    self.puts("run error!\n")
+                    continue
+                self.puts("starting from entry point: %x\n" % self.entry_point)
+                if reset_baud:  # 以降の出力はOSのもの
+                    self.line.set_baud(SERIAL_DEFAULT_BAUD)
+                self.puts("(kzsim) %d bytes loaded in %d segments\n" % (
+                    sum(len(d) for d in self.memory.values()), len(self.memory)))
+                if once:
+                    return
+                self.entry_point = None
+            else:
+                self.puts("unknown.\n")
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--link")
+    parser.add_argument("--baud", type=int, default=9600)
+    parser.add_argument("--no-crc", action="store_true")
+    parser.add_argument("--error-rate", type=float, default=0.0)
+    parser.add_argument("--once", action="store_true")
+    parser.add_argument("--reset-baud", action="store_true")
+    args = parser.parse_args(argv[1:])
+
+    master, slave = os.openpty()
+    tty.setraw(slave)  # ホストが開く前に書いた分も無変換で届くように
+    name = os.ttyname(slave)
+    if args.link:
+        if os.path.lexists(args.link):
+            os.unlink(args.link)
+        os.symlink(name, args.link)
+    sys.stderr.write("kzsim: listening on %s\n" % (args.link or name))
+    sys.stderr.flush()
+
+    line = Line(master, args.baud, args.error_rate)
+    board = Board(line, not args.no_crc)
+    try:
+        board.puts("kzload (kozos boot loader) started.\n")
+        board.run(args.once, args.reset_baud)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))